@@ -0,0 +1,111 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN(n) (((n) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+void arena_init(arena_t *arena)
+{
+    arena->chunk = NULL;
+    arena->allocated = 0;
+    arena->n_chunks = 0;
+}
+
+static arena_chunk_t *arena_grow(arena_t *arena, size_t size)
+{
+    if (size < ARENA_CHUNK_SIZE)
+        size = ARENA_CHUNK_SIZE;
+
+    arena_chunk_t *chunk = malloc(sizeof(arena_chunk_t) + size);
+    if (chunk == NULL) {
+        perror("malloc");
+        abort();
+    }
+
+    chunk->prev = arena->chunk;
+    chunk->size = size;
+    chunk->used = 0;
+
+    arena->chunk = chunk;
+    arena->n_chunks++;
+    return chunk;
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    size = ARENA_ALIGN(size);
+
+    arena_chunk_t *chunk = arena->chunk;
+    if (chunk == NULL || chunk->size - chunk->used < size)
+        chunk = arena_grow(arena, size);
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->allocated += size;
+    return ptr;
+}
+
+void *arena_calloc(arena_t *arena, size_t n, size_t size)
+{
+    void *ptr = arena_alloc(arena, n * size);
+    memset(ptr, 0, n * size);
+    return ptr;
+}
+
+void *arena_realloc(arena_t *arena, void *ptr, size_t old_size, size_t new_size)
+{
+    arena_chunk_t *chunk = arena->chunk;
+    old_size = ARENA_ALIGN(old_size);
+
+    // Grow in place if ptr is the last allocation of the current chunk
+    if (ptr != NULL && chunk != NULL
+        && (char *)ptr + old_size == chunk->data + chunk->used
+        && chunk->size - chunk->used + old_size >= ARENA_ALIGN(new_size)) {
+        chunk->used += ARENA_ALIGN(new_size) - old_size;
+        arena->allocated += ARENA_ALIGN(new_size) - old_size;
+        return ptr;
+    }
+
+    void *new = arena_alloc(arena, new_size);
+    if (ptr != NULL)
+        memcpy(new, ptr, old_size < new_size ? old_size : new_size);
+    return new;
+}
+
+char *arena_strndup(arena_t *arena, const char *str, size_t len)
+{
+    char *dup = arena_alloc(arena, len + 1);
+    memcpy(dup, str, len);
+    dup[len] = '\0';
+    return dup;
+}
+
+arena_mark_t arena_save(arena_t *arena)
+{
+    arena_mark_t mark;
+    mark.chunk = arena->chunk;
+    mark.used = arena->chunk ? arena->chunk->used : 0;
+    return mark;
+}
+
+void arena_restore(arena_t *arena, arena_mark_t mark)
+{
+    while (arena->chunk != mark.chunk) {
+        arena_chunk_t *prev = arena->chunk->prev;
+        free(arena->chunk);
+        arena->chunk = prev;
+        arena->n_chunks--;
+    }
+
+    if (arena->chunk)
+        arena->chunk->used = mark.used;
+}
+
+void arena_free(arena_t *arena)
+{
+    arena_mark_t mark = { NULL, 0 };
+    arena_restore(arena, mark);
+}
@@ -0,0 +1,42 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+typedef struct arena_chunk {
+    struct arena_chunk *prev;
+    size_t size;
+    size_t used;
+    _Alignas(max_align_t) char data[];
+} arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t *chunk;
+    size_t allocated;
+    size_t n_chunks;
+} arena_t;
+
+typedef struct {
+    arena_chunk_t *chunk;
+    size_t used;
+} arena_mark_t;
+
+void arena_init(arena_t *arena);
+
+void *arena_alloc(arena_t *arena, size_t size);
+
+void *arena_calloc(arena_t *arena, size_t n, size_t size);
+
+void *arena_realloc(arena_t *arena, void *ptr, size_t old_size, size_t new_size);
+
+char *arena_strndup(arena_t *arena, const char *str, size_t len);
+
+arena_mark_t arena_save(arena_t *arena);
+
+void arena_restore(arena_t *arena, arena_mark_t mark);
+
+void arena_free(arena_t *arena);
+
+#endif
@@ -0,0 +1,917 @@
+#include <elf.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm.h"
+
+static const char *regs[] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15",
+};
+
+static const char *conds[] = {
+    [ASM_CC_E] = "e",
+    [ASM_CC_NE] = "ne",
+    [ASM_CC_BE] = "be",
+    [ASM_CC_A] = "a",
+};
+
+// rel8 branches are resolved by asm_finish and never reach the object
+#define ASM_FIXUP_REL8 0x100
+
+static const char *sections[ASM_SECTIONS] = {
+    [ASM_TEXT] = ".text",
+    [ASM_RODATA] = ".rodata",
+    [ASM_DATA] = ".data.rel.ro",
+    [ASM_BSS] = ".bss",
+};
+
+void asm_init(asm_t *as, arena_t *arena, asm_mode_t mode, FILE *file)
+{
+    memset(as, 0, sizeof(asm_t));
+    as->arena = arena;
+    as->mode = mode;
+    as->file = file;
+    as->section = ASM_TEXT;
+}
+
+static bool asm_text(asm_t *as)
+{
+    return as->mode == ASM_MODE_TEXT;
+}
+
+static asm_buf_t *asm_buf(asm_t *as)
+{
+    return &as->sections[as->section];
+}
+
+static void asm_reserve(asm_buf_t *buf, size_t size)
+{
+    if (buf->len + size <= buf->cap)
+        return;
+
+    while (buf->len + size > buf->cap)
+        buf->cap = buf->cap ? buf->cap * 2 : 4096;
+    buf->data = realloc(buf->data, buf->cap);
+}
+
+static void asm_bytes(asm_t *as, const void *data, size_t size)
+{
+    asm_buf_t *buf = asm_buf(as);
+    asm_reserve(buf, size);
+    memcpy(buf->data + buf->len, data, size);
+    buf->len += size;
+}
+
+static void asm_byte(asm_t *as, uint8_t byte)
+{
+    asm_bytes(as, &byte, 1);
+}
+
+static void asm_u32(asm_t *as, uint32_t value)
+{
+    asm_bytes(as, &value, 4);
+}
+
+static uint32_t asm_label_id(asm_t *as, sym_t name)
+{
+    intptr_t id;
+    if (env_find(as->label_ids, name, &id))
+        return id;
+
+    as->labels = realloc(as->labels, ++as->n_labels * sizeof(asm_label_t));
+    as->labels[as->n_labels - 1] = (asm_label_t){ .name = name };
+    as->label_ids = env_append(as->arena, as->label_ids, name, as->n_labels - 1);
+    return as->n_labels - 1;
+}
+
+static void asm_fixup(asm_t *as, sym_t name, uint32_t type)
+{
+    as->fixups = realloc(as->fixups, ++as->n_fixups * sizeof(asm_fixup_t));
+    as->fixups[as->n_fixups - 1] = (asm_fixup_t){
+        .section = as->section,
+        .offset = asm_buf(as)->len,
+        .label = asm_label_id(as, name),
+        .type = type,
+    };
+
+    if (type == ASM_FIXUP_REL8)
+        asm_byte(as, 0);
+    else if (type == R_X86_64_64)
+        asm_bytes(as, &(uint64_t){ 0 }, 8);
+    else
+        asm_u32(as, 0);
+}
+
+// REX.W prefix with the high bits of the reg and r/m fields
+static void asm_rex(asm_t *as, asm_reg_t reg, asm_reg_t rm)
+{
+    asm_byte(as, 0x48 | (reg >> 3) << 2 | rm >> 3);
+}
+
+static void asm_modrm_mem(asm_t *as, asm_reg_t reg, asm_reg_t base, int32_t disp)
+{
+    uint8_t mod;
+    if (disp == 0 && (base & 7) != ASM_RBP)
+        mod = 0x00;
+    else if (disp >= INT8_MIN && disp <= INT8_MAX)
+        mod = 0x40;
+    else
+        mod = 0x80;
+
+    asm_byte(as, mod | (reg & 7) << 3 | (base & 7));
+
+    // rsp and r12 as a base need a SIB byte
+    if ((base & 7) == ASM_RSP)
+        asm_byte(as, 0x24);
+
+    if (mod == 0x40)
+        asm_byte(as, disp);
+    else if (mod == 0x80)
+        asm_u32(as, disp);
+}
+
+static void asm_modrm_rip(asm_t *as, asm_reg_t reg, sym_t name, uint32_t type)
+{
+    asm_byte(as, 0x05 | (reg & 7) << 3);
+    asm_fixup(as, name, type);
+}
+
+static void asm_modrm_reg(asm_t *as, asm_reg_t reg, asm_reg_t rm)
+{
+    asm_byte(as, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+static void asm_print_mem(asm_t *as, asm_reg_t base, int32_t disp)
+{
+    if (disp != 0)
+        fprintf(as->file, "%d", disp);
+    fprintf(as->file, "(%%%s)", regs[base]);
+}
+
+void asm_section(asm_t *as, asm_section_t section)
+{
+    as->section = section;
+
+    if (asm_text(as))
+        fprintf(as->file, "\n.section %s\n", sections[section]);
+}
+
+void asm_label(asm_t *as, sym_t name)
+{
+    uint32_t id = asm_label_id(as, name);
+    asm_label_t *label = &as->labels[id];
+    label->defined = true;
+    label->section = as->section;
+    label->offset = asm_buf(as)->len;
+
+    if (asm_text(as))
+        fprintf(as->file, "%s:\n", sym_name(name));
+}
+
+sym_t asm_local(asm_t *as)
+{
+    char name[16];
+    int len = snprintf(name, sizeof(name), ".L%u", as->n_locals++);
+    return sym_intern(name, len);
+}
+
+void asm_global(asm_t *as, sym_t name)
+{
+    uint32_t id = asm_label_id(as, name);
+    as->labels[id].global = true;
+
+    if (asm_text(as))
+        fprintf(as->file, ".globl %s\n", sym_name(name));
+}
+
+void asm_extern(asm_t *as, sym_t name)
+{
+    // Undefined labels become undefined symbols in the object
+    asm_label_id(as, name);
+
+    if (asm_text(as))
+        fprintf(as->file, "\t.extern %s\n", sym_name(name));
+}
+
+void asm_comment(asm_t *as, const char *fmt, ...)
+{
+    if (!asm_text(as))
+        return;
+
+    va_list args;
+    va_start(args, fmt);
+    fputs("\t# ", as->file);
+    vfprintf(as->file, fmt, args);
+    fputc('\n', as->file);
+    va_end(args);
+}
+
+void asm_align(asm_t *as, size_t align)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, ".align %zu\n", align);
+        return;
+    }
+
+    asm_skip(as, -asm_buf(as)->len & (align - 1));
+}
+
+void asm_skip(asm_t *as, size_t size)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\t.skip %zu\n", size);
+        return;
+    }
+
+    // .bss only has a size
+    asm_buf_t *buf = asm_buf(as);
+    if (as->section != ASM_BSS && size > 0) {
+        asm_reserve(buf, size);
+        memset(buf->data + buf->len, 0, size);
+    }
+    buf->len += size;
+}
+
+void asm_quad(asm_t *as, uint64_t value)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\t.quad %lu\n", value);
+        return;
+    }
+
+    asm_bytes(as, &value, 8);
+}
+
+void asm_quad_sym(asm_t *as, sym_t name)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\t.quad %s\n", sym_name(name));
+        return;
+    }
+
+    asm_fixup(as, name, R_X86_64_64);
+}
+
+static size_t asm_octal(const char *str, uint8_t *byte)
+{
+    size_t i = 0;
+    for (*byte = 0; i < 3 && str[i] >= '0' && str[i] <= '7'; i++)
+        *byte = *byte * 8 + str[i] - '0';
+    return i;
+}
+
+static size_t asm_hex(const char *str, uint8_t *byte)
+{
+    size_t i = 0;
+    for (*byte = 0; ; i++) {
+        char c = str[i];
+        if (c >= '0' && c <= '9')
+            *byte = *byte * 16 + c - '0';
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+            *byte = *byte * 16 + (c | 0x20) - 'a' + 10;
+        else
+            return i;
+    }
+}
+
+void asm_string(asm_t *as, const char *str)
+{
+    // Literals keep their escapes, which both modes decode like gas does
+    if (asm_text(as)) {
+        fprintf(as->file, "\t.asciz \"%s\\0\"\n", str);
+        return;
+    }
+
+    while (*str) {
+        uint8_t byte = *str++;
+        if (byte == '\\' && *str) {
+            switch (byte = *str++) {
+                case 'b': byte = '\b'; break;
+                case 'f': byte = '\f'; break;
+                case 'n': byte = '\n'; break;
+                case 'r': byte = '\r'; break;
+                case 't': byte = '\t'; break;
+                case 'x': str += asm_hex(str, &byte); break;
+                default:
+                    if (byte >= '0' && byte <= '7')
+                        str += asm_octal(str - 1, &byte) - 1;
+                    break;
+            }
+        }
+        asm_byte(as, byte);
+    }
+
+    asm_byte(as, 0);
+    asm_byte(as, 0);
+}
+
+void asm_mov(asm_t *as, asm_reg_t dst, asm_reg_t src)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\tmovq %%%s, %%%s\n", regs[src], regs[dst]);
+        return;
+    }
+
+    asm_rex(as, src, dst);
+    asm_byte(as, 0x89);
+    asm_modrm_reg(as, src, dst);
+}
+
+void asm_mov_imm(asm_t *as, asm_reg_t dst, int64_t imm)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\tmovq $%ld, %%%s\n", imm, regs[dst]);
+        return;
+    }
+
+    if (imm >= INT32_MIN && imm <= INT32_MAX) {
+        asm_rex(as, 0, dst);
+        asm_byte(as, 0xC7);
+        asm_modrm_reg(as, 0, dst);
+        asm_u32(as, imm);
+    } else {
+        asm_rex(as, 0, dst);
+        asm_byte(as, 0xB8 | (dst & 7));
+        asm_bytes(as, &imm, 8);
+    }
+}
+
+void asm_load(asm_t *as, asm_reg_t dst, asm_reg_t base, int32_t disp)
+{
+    if (asm_text(as)) {
+        fputs("\tmovq ", as->file);
+        asm_print_mem(as, base, disp);
+        fprintf(as->file, ", %%%s\n", regs[dst]);
+        return;
+    }
+
+    asm_rex(as, dst, base);
+    asm_byte(as, 0x8B);
+    asm_modrm_mem(as, dst, base, disp);
+}
+
+void asm_store(asm_t *as, asm_reg_t base, int32_t disp, asm_reg_t src)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\tmovq %%%s, ", regs[src]);
+        asm_print_mem(as, base, disp);
+        fputc('\n', as->file);
+        return;
+    }
+
+    asm_rex(as, src, base);
+    asm_byte(as, 0x89);
+    asm_modrm_mem(as, src, base, disp);
+}
+
+void asm_load_sym(asm_t *as, asm_reg_t dst, sym_t name)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\tmovq %s(%%rip), %%%s\n", sym_name(name), regs[dst]);
+        return;
+    }
+
+    asm_rex(as, dst, 0);
+    asm_byte(as, 0x8B);
+    asm_modrm_rip(as, dst, name, R_X86_64_PC32);
+}
+
+void asm_store_sym(asm_t *as, sym_t name, asm_reg_t src)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\tmovq %%%s, %s(%%rip)\n", regs[src], sym_name(name));
+        return;
+    }
+
+    asm_rex(as, src, 0);
+    asm_byte(as, 0x89);
+    asm_modrm_rip(as, src, name, R_X86_64_PC32);
+}
+
+void asm_lea(asm_t *as, asm_reg_t dst, asm_reg_t base, int32_t disp)
+{
+    if (asm_text(as)) {
+        fputs("\tleaq ", as->file);
+        asm_print_mem(as, base, disp);
+        fprintf(as->file, ", %%%s\n", regs[dst]);
+        return;
+    }
+
+    asm_rex(as, dst, base);
+    asm_byte(as, 0x8D);
+    asm_modrm_mem(as, dst, base, disp);
+}
+
+void asm_lea_sym(asm_t *as, asm_reg_t dst, sym_t name)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\tleaq %s(%%rip), %%%s\n", sym_name(name), regs[dst]);
+        return;
+    }
+
+    asm_rex(as, dst, 0);
+    asm_byte(as, 0x8D);
+    asm_modrm_rip(as, dst, name, R_X86_64_PC32);
+}
+
+void asm_lea_got(asm_t *as, asm_reg_t dst, sym_t name)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\tleaq %s@GOTPCREL(%%rip), %%%s\n", sym_name(name), regs[dst]);
+        return;
+    }
+
+    asm_rex(as, dst, 0);
+    asm_byte(as, 0x8D);
+    asm_modrm_rip(as, dst, name, R_X86_64_GOTPCREL);
+}
+
+void asm_push(asm_t *as, asm_reg_t reg)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\tpushq %%%s\n", regs[reg]);
+        return;
+    }
+
+    if (reg >= ASM_R8)
+        asm_byte(as, 0x41);
+    asm_byte(as, 0x50 | (reg & 7));
+}
+
+void asm_pop(asm_t *as, asm_reg_t reg)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\tpopq %%%s\n", regs[reg]);
+        return;
+    }
+
+    if (reg >= ASM_R8)
+        asm_byte(as, 0x41);
+    asm_byte(as, 0x58 | (reg & 7));
+}
+
+void asm_sub_imm(asm_t *as, asm_reg_t dst, int32_t imm)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\tsubq $%d, %%%s\n", imm, regs[dst]);
+        return;
+    }
+
+    asm_rex(as, 0, dst);
+    if (imm >= INT8_MIN && imm <= INT8_MAX) {
+        asm_byte(as, 0x83);
+        asm_modrm_reg(as, 5, dst);
+        asm_byte(as, imm);
+    } else if (dst == ASM_RAX) {
+        asm_byte(as, 0x2D);
+        asm_u32(as, imm);
+    } else {
+        asm_byte(as, 0x81);
+        asm_modrm_reg(as, 5, dst);
+        asm_u32(as, imm);
+    }
+}
+
+void asm_add(asm_t *as, asm_reg_t dst, asm_reg_t src)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\taddq %%%s, %%%s\n", regs[src], regs[dst]);
+        return;
+    }
+
+    asm_rex(as, src, dst);
+    asm_byte(as, 0x01);
+    asm_modrm_reg(as, src, dst);
+}
+
+void asm_add_imm(asm_t *as, asm_reg_t dst, int32_t imm)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\taddq $%d, %%%s\n", imm, regs[dst]);
+        return;
+    }
+
+    asm_rex(as, 0, dst);
+    if (imm >= INT8_MIN && imm <= INT8_MAX) {
+        asm_byte(as, 0x83);
+        asm_modrm_reg(as, 0, dst);
+        asm_byte(as, imm);
+    } else if (dst == ASM_RAX) {
+        asm_byte(as, 0x05);
+        asm_u32(as, imm);
+    } else {
+        asm_byte(as, 0x81);
+        asm_modrm_reg(as, 0, dst);
+        asm_u32(as, imm);
+    }
+}
+
+void asm_cmp_sym(asm_t *as, asm_reg_t reg, sym_t name)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\tcmpq %s(%%rip), %%%s\n", sym_name(name), regs[reg]);
+        return;
+    }
+
+    asm_rex(as, reg, 0);
+    asm_byte(as, 0x3B);
+    asm_modrm_rip(as, reg, name, R_X86_64_PC32);
+}
+
+void asm_xor(asm_t *as, asm_reg_t dst, asm_reg_t src)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\txorq %%%s, %%%s\n", regs[src], regs[dst]);
+        return;
+    }
+
+    asm_rex(as, src, dst);
+    asm_byte(as, 0x31);
+    asm_modrm_reg(as, src, dst);
+}
+
+void asm_call(asm_t *as, sym_t name)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\tcall %s\n", sym_name(name));
+        return;
+    }
+
+    asm_byte(as, 0xE8);
+    asm_fixup(as, name, R_X86_64_PLT32);
+}
+
+void asm_call_mem(asm_t *as, asm_reg_t base, int32_t disp)
+{
+    if (asm_text(as)) {
+        fputs("\tcall *", as->file);
+        asm_print_mem(as, base, disp);
+        fputc('\n', as->file);
+        return;
+    }
+
+    if (base >= ASM_R8)
+        asm_byte(as, 0x41);
+    asm_byte(as, 0xFF);
+    asm_modrm_mem(as, 2, base, disp);
+}
+
+void asm_jcc(asm_t *as, asm_cond_t cc, sym_t label)
+{
+    if (asm_text(as)) {
+        fprintf(as->file, "\tj%s %s\n", conds[cc], sym_name(label));
+        return;
+    }
+
+    asm_byte(as, 0x70 | cc);
+    asm_fixup(as, label, ASM_FIXUP_REL8);
+}
+
+void asm_jmp(asm_t *as, sym_t name)
+{
+    // Always rel32, gas would otherwise shorten jumps to near labels
+    if (asm_text(as)) {
+        fprintf(as->file, "\t{disp32} jmp %s\n", sym_name(name));
+        return;
+    }
+
+    asm_byte(as, 0xE9);
+    asm_fixup(as, name, R_X86_64_PLT32);
+}
+
+void asm_jmp_mem(asm_t *as, asm_reg_t base, int32_t disp)
+{
+    if (asm_text(as)) {
+        fputs("\tjmp *", as->file);
+        asm_print_mem(as, base, disp);
+        fputc('\n', as->file);
+        return;
+    }
+
+    if (base >= ASM_R8)
+        asm_byte(as, 0x41);
+    asm_byte(as, 0xFF);
+    asm_modrm_mem(as, 4, base, disp);
+}
+
+void asm_leave(asm_t *as)
+{
+    if (asm_text(as)) {
+        fputs("\tleave\n", as->file);
+        return;
+    }
+
+    asm_byte(as, 0xC9);
+}
+
+void asm_ret(asm_t *as)
+{
+    if (asm_text(as)) {
+        fputs("\tret\n\n", as->file);
+        return;
+    }
+
+    asm_byte(as, 0xC3);
+}
+
+// Section header indices of the object
+enum {
+    ASM_SHN_TEXT = 1,
+    ASM_SHN_RODATA,
+    ASM_SHN_DATA,
+    ASM_SHN_BSS,
+    ASM_SHN_NOTE,
+    ASM_SHN_SYMTAB,
+    ASM_SHN_STRTAB,
+    ASM_SHN_RELA,
+    ASM_SHN_RELA_DATA,
+    ASM_SHN_SHSTRTAB,
+    ASM_SHN_COUNT,
+};
+
+static const uint16_t section_shndx[ASM_SECTIONS] = {
+    [ASM_TEXT] = ASM_SHN_TEXT,
+    [ASM_RODATA] = ASM_SHN_RODATA,
+    [ASM_DATA] = ASM_SHN_DATA,
+    [ASM_BSS] = ASM_SHN_BSS,
+};
+
+// The sections relocations can be written for
+static const uint16_t section_rela[ASM_SECTIONS] = {
+    [ASM_TEXT] = ASM_SHN_RELA,
+    [ASM_DATA] = ASM_SHN_RELA_DATA,
+};
+
+static size_t asm_strtab(asm_buf_t *strtab, const char *str)
+{
+    size_t offset = strtab->len;
+    size_t len = strlen(str) + 1;
+    asm_reserve(strtab, len);
+    memcpy(strtab->data + strtab->len, str, len);
+    strtab->len += len;
+    return offset;
+}
+
+static void asm_write(FILE *file, asm_buf_t *buf, Elf64_Shdr *shdr)
+{
+    shdr->sh_offset = ftell(file);
+    shdr->sh_size = buf->len;
+    fwrite(buf->data, 1, buf->len, file);
+}
+
+static bool asm_write_elf(asm_t *as)
+{
+    asm_buf_t *text = &as->sections[ASM_TEXT];
+    asm_buf_t symtab = { 0 }, strtab = { 0 }, shstrtab = { 0 };
+    asm_buf_t rela[ASM_SECTIONS] = { 0 };
+
+    // Branches and references within .text are resolved here, everything
+    // else is left to the linker
+    size_t n_relocs = 0;
+    for (size_t i = 0; i < as->n_fixups; i++) {
+        asm_fixup_t *fixup = &as->fixups[i];
+        asm_label_t *label = &as->labels[fixup->label];
+
+        if (fixup->section == ASM_TEXT && label->defined && label->section == ASM_TEXT
+            && fixup->type != R_X86_64_GOTPCREL) {
+            int32_t rel = label->offset - (fixup->offset + 4);
+            memcpy(text->data + fixup->offset, &rel, 4);
+            continue;
+        }
+
+        // .L labels get no symbol to relocate against
+        if (strncmp(sym_name(label->name), ".L", 2) == 0) {
+            printf("Local label '%s' cannot be relocated\n", sym_name(label->name));
+            return false;
+        }
+        if (section_rela[fixup->section] == 0) {
+            printf("Reference to '%s' in a section without relocations\n", sym_name(label->name));
+            return false;
+        }
+        as->fixups[n_relocs++] = *fixup;
+    }
+
+    // Local symbols have to come before global ones
+    Elf64_Sym sym = { 0 };
+    asm_strtab(&strtab, "");
+    asm_reserve(&symtab, sizeof(Elf64_Sym));
+    memcpy(symtab.data, &sym, sizeof(Elf64_Sym));
+    symtab.len = sizeof(Elf64_Sym);
+
+    uint32_t n_syms = 1, n_locals = 0;
+    for (int global = 0; global < 2; global++) {
+        for (size_t i = 0; i < as->n_labels; i++) {
+            asm_label_t *label = &as->labels[i];
+            if ((label->global || !label->defined) != global)
+                continue;
+
+            // Like gas, .L labels are only for branches
+            if (strncmp(sym_name(label->name), ".L", 2) == 0)
+                continue;
+
+            sym.st_name = asm_strtab(&strtab, sym_name(label->name));
+            sym.st_info = ELF64_ST_INFO(global ? STB_GLOBAL : STB_LOCAL,
+                                        label->section == ASM_TEXT ? STT_FUNC : STT_OBJECT);
+            sym.st_shndx = label->defined ? section_shndx[label->section] : SHN_UNDEF;
+            sym.st_value = label->defined ? label->offset : 0;
+
+            if (!label->defined)
+                sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+
+            asm_reserve(&symtab, sizeof(Elf64_Sym));
+            memcpy(symtab.data + symtab.len, &sym, sizeof(Elf64_Sym));
+            symtab.len += sizeof(Elf64_Sym);
+            label->elf_index = n_syms++;
+        }
+
+        if (!global)
+            n_locals = n_syms;
+    }
+
+    // A rel32 field ends its instruction, addresses in data are absolute
+    for (size_t i = 0; i < n_relocs; i++) {
+        asm_fixup_t *fixup = &as->fixups[i];
+        Elf64_Rela reloc = {
+            .r_offset = fixup->offset,
+            .r_info = ELF64_R_INFO(as->labels[fixup->label].elf_index, fixup->type),
+            .r_addend = fixup->type == R_X86_64_64 ? 0 : -4,
+        };
+
+        asm_buf_t *buf = &rela[fixup->section];
+        asm_reserve(buf, sizeof(Elf64_Rela));
+        memcpy(buf->data + buf->len, &reloc, sizeof(Elf64_Rela));
+        buf->len += sizeof(Elf64_Rela);
+    }
+
+    Elf64_Shdr shdrs[ASM_SHN_COUNT] = { 0 };
+    asm_strtab(&shstrtab, "");
+
+    shdrs[ASM_SHN_TEXT].sh_name = asm_strtab(&shstrtab, ".text");
+    shdrs[ASM_SHN_TEXT].sh_type = SHT_PROGBITS;
+    shdrs[ASM_SHN_TEXT].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    shdrs[ASM_SHN_TEXT].sh_addralign = 16;
+
+    shdrs[ASM_SHN_RODATA].sh_name = asm_strtab(&shstrtab, ".rodata");
+    shdrs[ASM_SHN_RODATA].sh_type = SHT_PROGBITS;
+    shdrs[ASM_SHN_RODATA].sh_flags = SHF_ALLOC;
+    shdrs[ASM_SHN_RODATA].sh_addralign = 8;
+
+    shdrs[ASM_SHN_DATA].sh_name = asm_strtab(&shstrtab, ".data.rel.ro");
+    shdrs[ASM_SHN_DATA].sh_type = SHT_PROGBITS;
+    shdrs[ASM_SHN_DATA].sh_flags = SHF_ALLOC | SHF_WRITE;
+    shdrs[ASM_SHN_DATA].sh_addralign = 8;
+
+    shdrs[ASM_SHN_BSS].sh_name = asm_strtab(&shstrtab, ".bss");
+    shdrs[ASM_SHN_BSS].sh_type = SHT_NOBITS;
+    shdrs[ASM_SHN_BSS].sh_flags = SHF_ALLOC | SHF_WRITE;
+    shdrs[ASM_SHN_BSS].sh_size = as->sections[ASM_BSS].len;
+    shdrs[ASM_SHN_BSS].sh_addralign = 8;
+
+    shdrs[ASM_SHN_NOTE].sh_name = asm_strtab(&shstrtab, ".note.GNU-stack");
+    shdrs[ASM_SHN_NOTE].sh_type = SHT_PROGBITS;
+    shdrs[ASM_SHN_NOTE].sh_addralign = 1;
+
+    shdrs[ASM_SHN_SYMTAB].sh_name = asm_strtab(&shstrtab, ".symtab");
+    shdrs[ASM_SHN_SYMTAB].sh_type = SHT_SYMTAB;
+    shdrs[ASM_SHN_SYMTAB].sh_link = ASM_SHN_STRTAB;
+    shdrs[ASM_SHN_SYMTAB].sh_info = n_locals;
+    shdrs[ASM_SHN_SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+    shdrs[ASM_SHN_SYMTAB].sh_addralign = 8;
+
+    shdrs[ASM_SHN_STRTAB].sh_name = asm_strtab(&shstrtab, ".strtab");
+    shdrs[ASM_SHN_STRTAB].sh_type = SHT_STRTAB;
+    shdrs[ASM_SHN_STRTAB].sh_addralign = 1;
+
+    shdrs[ASM_SHN_RELA].sh_name = asm_strtab(&shstrtab, ".rela.text");
+    shdrs[ASM_SHN_RELA].sh_type = SHT_RELA;
+    shdrs[ASM_SHN_RELA].sh_flags = SHF_INFO_LINK;
+    shdrs[ASM_SHN_RELA].sh_link = ASM_SHN_SYMTAB;
+    shdrs[ASM_SHN_RELA].sh_info = ASM_SHN_TEXT;
+    shdrs[ASM_SHN_RELA].sh_entsize = sizeof(Elf64_Rela);
+    shdrs[ASM_SHN_RELA].sh_addralign = 8;
+
+    shdrs[ASM_SHN_RELA_DATA].sh_name = asm_strtab(&shstrtab, ".rela.data.rel.ro");
+    shdrs[ASM_SHN_RELA_DATA].sh_type = SHT_RELA;
+    shdrs[ASM_SHN_RELA_DATA].sh_flags = SHF_INFO_LINK;
+    shdrs[ASM_SHN_RELA_DATA].sh_link = ASM_SHN_SYMTAB;
+    shdrs[ASM_SHN_RELA_DATA].sh_info = ASM_SHN_DATA;
+    shdrs[ASM_SHN_RELA_DATA].sh_entsize = sizeof(Elf64_Rela);
+    shdrs[ASM_SHN_RELA_DATA].sh_addralign = 8;
+
+    shdrs[ASM_SHN_SHSTRTAB].sh_name = asm_strtab(&shstrtab, ".shstrtab");
+    shdrs[ASM_SHN_SHSTRTAB].sh_type = SHT_STRTAB;
+    shdrs[ASM_SHN_SHSTRTAB].sh_addralign = 1;
+
+    Elf64_Ehdr ehdr = {
+        .e_ident = {
+            ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3,
+            ELFCLASS64, ELFDATA2LSB, EV_CURRENT, ELFOSABI_SYSV,
+        },
+        .e_type = ET_REL,
+        .e_machine = EM_X86_64,
+        .e_version = EV_CURRENT,
+        .e_ehsize = sizeof(Elf64_Ehdr),
+        .e_shentsize = sizeof(Elf64_Shdr),
+        .e_shnum = ASM_SHN_COUNT,
+        .e_shstrndx = ASM_SHN_SHSTRTAB,
+    };
+
+    // Header, section contents, then the section headers
+    FILE *file = as->file;
+    fwrite(&ehdr, 1, sizeof(ehdr), file);
+    asm_write(file, text, &shdrs[ASM_SHN_TEXT]);
+    asm_write(file, &as->sections[ASM_RODATA], &shdrs[ASM_SHN_RODATA]);
+
+    long pad = -ftell(file) & 7;
+    fwrite("\0\0\0\0\0\0\0", 1, pad, file);
+    asm_write(file, &as->sections[ASM_DATA], &shdrs[ASM_SHN_DATA]);
+    shdrs[ASM_SHN_BSS].sh_offset = ftell(file);
+    shdrs[ASM_SHN_NOTE].sh_offset = ftell(file);
+
+    pad = -ftell(file) & 7;
+    fwrite("\0\0\0\0\0\0\0", 1, pad, file);
+    asm_write(file, &symtab, &shdrs[ASM_SHN_SYMTAB]);
+    asm_write(file, &strtab, &shdrs[ASM_SHN_STRTAB]);
+
+    pad = -ftell(file) & 7;
+    fwrite("\0\0\0\0\0\0\0", 1, pad, file);
+    asm_write(file, &rela[ASM_TEXT], &shdrs[ASM_SHN_RELA]);
+    asm_write(file, &rela[ASM_DATA], &shdrs[ASM_SHN_RELA_DATA]);
+    asm_write(file, &shstrtab, &shdrs[ASM_SHN_SHSTRTAB]);
+
+    pad = -ftell(file) & 7;
+    fwrite("\0\0\0\0\0\0\0", 1, pad, file);
+    ehdr.e_shoff = ftell(file);
+    fwrite(shdrs, 1, sizeof(shdrs), file);
+
+    fseek(file, 0, SEEK_SET);
+    fwrite(&ehdr, 1, sizeof(ehdr), file);
+
+    free(symtab.data);
+    free(strtab.data);
+    for (size_t i = 0; i < ASM_SECTIONS; i++)
+        free(rela[i].data);
+    free(shstrtab.data);
+
+    if (ferror(file)) {
+        printf("Failed to write object file\n");
+        return false;
+    }
+    return true;
+}
+
+// Patches the short branches, leaving only rel32 fixups
+static bool asm_resolve_short(asm_t *as)
+{
+    size_t n_fixups = 0;
+    for (size_t i = 0; i < as->n_fixups; i++) {
+        asm_fixup_t *fixup = &as->fixups[i];
+        if (fixup->type != ASM_FIXUP_REL8) {
+            as->fixups[n_fixups++] = *fixup;
+            continue;
+        }
+
+        asm_label_t *label = &as->labels[fixup->label];
+        int64_t rel = (int64_t)label->offset - (int64_t)(fixup->offset + 1);
+        if (!label->defined || label->section != ASM_TEXT || rel < INT8_MIN || rel > INT8_MAX) {
+            printf("Short branch to '%s' out of range\n", sym_name(label->name));
+            return false;
+        }
+
+        as->sections[ASM_TEXT].data[fixup->offset] = rel;
+    }
+
+    as->n_fixups = n_fixups;
+    return true;
+}
+
+bool asm_finish(asm_t *as)
+{
+    if (!asm_resolve_short(as))
+        return false;
+
+    switch (as->mode) {
+        case ASM_MODE_TEXT:
+            fputs("\n.section .note.GNU-stack,\"\",@progbits\n", as->file);
+            return true;
+
+        case ASM_MODE_ELF:
+            return asm_write_elf(as);
+
+        case ASM_MODE_JIT:
+            return true;
+    }
+    return false;
+}
+
+void asm_free(asm_t *as)
+{
+    for (size_t i = 0; i < ASM_SECTIONS; i++)
+        free(as->sections[i].data);
+    free(as->labels);
+    free(as->fixups);
+}
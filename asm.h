@@ -0,0 +1,159 @@
+#ifndef ASM_H
+#define ASM_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arena.h"
+#include "env.h"
+#include "sym.h"
+
+typedef enum {
+    ASM_RAX, ASM_RCX, ASM_RDX, ASM_RBX,
+    ASM_RSP, ASM_RBP, ASM_RSI, ASM_RDI,
+    ASM_R8,  ASM_R9,  ASM_R10, ASM_R11,
+    ASM_R12, ASM_R13, ASM_R14, ASM_R15,
+} asm_reg_t;
+
+// Condition codes as encoded in jcc
+typedef enum {
+    ASM_CC_E = 0x4,
+    ASM_CC_NE = 0x5,
+    ASM_CC_BE = 0x6,
+    ASM_CC_A = 0x7,
+} asm_cond_t;
+
+typedef enum {
+    ASM_TEXT,
+    ASM_RODATA,
+    // Addresses, read-only once the loader has relocated them
+    ASM_DATA,
+    ASM_BSS,
+    ASM_SECTIONS,
+} asm_section_t;
+
+typedef enum {
+    // AT&T assembly for gcc to assemble
+    ASM_MODE_TEXT,
+    // x86-64 machine code in an ELF relocatable object
+    ASM_MODE_ELF,
+    // x86-64 machine code left in memory for jit_load
+    ASM_MODE_JIT,
+} asm_mode_t;
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} asm_buf_t;
+
+typedef struct {
+    sym_t name;
+    asm_section_t section;
+    size_t offset;
+    bool defined;
+    bool global;
+    uint32_t elf_index;
+} asm_label_t;
+
+typedef struct {
+    asm_section_t section;
+    size_t offset;
+    uint32_t label;
+    uint32_t type;
+} asm_fixup_t;
+
+typedef struct {
+    arena_t *arena;
+    asm_mode_t mode;
+    FILE *file;
+    asm_section_t section;
+    asm_buf_t sections[ASM_SECTIONS];
+    env_t *label_ids;
+    size_t n_labels;
+    asm_label_t *labels;
+    size_t n_fixups;
+    asm_fixup_t *fixups;
+    uint32_t n_locals;
+} asm_t;
+
+void asm_init(asm_t *as, arena_t *arena, asm_mode_t mode, FILE *file);
+
+void asm_section(asm_t *as, asm_section_t section);
+
+void asm_label(asm_t *as, sym_t name);
+
+// A fresh label that stays out of the object's symbols
+sym_t asm_local(asm_t *as);
+
+void asm_global(asm_t *as, sym_t name);
+
+void asm_extern(asm_t *as, sym_t name);
+
+void asm_comment(asm_t *as, const char *fmt, ...);
+
+void asm_align(asm_t *as, size_t align);
+
+void asm_skip(asm_t *as, size_t size);
+
+void asm_quad(asm_t *as, uint64_t value);
+
+// The absolute address of a label
+void asm_quad_sym(asm_t *as, sym_t name);
+
+void asm_string(asm_t *as, const char *str);
+
+void asm_mov(asm_t *as, asm_reg_t dst, asm_reg_t src);
+
+void asm_mov_imm(asm_t *as, asm_reg_t dst, int64_t imm);
+
+void asm_load(asm_t *as, asm_reg_t dst, asm_reg_t base, int32_t disp);
+
+void asm_store(asm_t *as, asm_reg_t base, int32_t disp, asm_reg_t src);
+
+void asm_load_sym(asm_t *as, asm_reg_t dst, sym_t name);
+
+void asm_store_sym(asm_t *as, sym_t name, asm_reg_t src);
+
+void asm_lea(asm_t *as, asm_reg_t dst, asm_reg_t base, int32_t disp);
+
+void asm_lea_sym(asm_t *as, asm_reg_t dst, sym_t name);
+
+void asm_lea_got(asm_t *as, asm_reg_t dst, sym_t name);
+
+void asm_push(asm_t *as, asm_reg_t reg);
+
+void asm_pop(asm_t *as, asm_reg_t reg);
+
+void asm_sub_imm(asm_t *as, asm_reg_t dst, int32_t imm);
+
+void asm_add(asm_t *as, asm_reg_t dst, asm_reg_t src);
+
+void asm_add_imm(asm_t *as, asm_reg_t dst, int32_t imm);
+
+void asm_cmp_sym(asm_t *as, asm_reg_t reg, sym_t name);
+
+void asm_xor(asm_t *as, asm_reg_t dst, asm_reg_t src);
+
+void asm_call(asm_t *as, sym_t name);
+
+void asm_call_mem(asm_t *as, asm_reg_t base, int32_t disp);
+
+// Short jump to a local label at most 127 bytes ahead
+void asm_jcc(asm_t *as, asm_cond_t cc, sym_t label);
+
+void asm_jmp(asm_t *as, sym_t name);
+
+void asm_jmp_mem(asm_t *as, asm_reg_t base, int32_t disp);
+
+void asm_leave(asm_t *as);
+
+void asm_ret(asm_t *as);
+
+bool asm_finish(asm_t *as);
+
+void asm_free(asm_t *as);
+
+#endif
@@ -0,0 +1,16 @@
+#!/bin/sh
+# usage: big.sh [N]
+# Prints a program of N (3000 by default) lambda declarations, each
+# allocating closures and calling a known lambda, for build times and
+# code size at scale.
+n=${1:-3000}
+
+printf '%s\n' 'let puts : Ffi (Str -> ()) = ffi_extern "puts";' \
+    'let print = \s -> ffi_call puts s;' \
+    'let twice = \f -> \x -> f (f x);'
+i=0
+while [ $i -lt $n ]; do
+    printf 'let f%d = \\x -> let y = twice (\\z -> z) x in \\w -> y;\n' $i
+    i=$((i + 1))
+done
+printf '%s\n' 'let main = print "big";'
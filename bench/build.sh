@@ -0,0 +1,33 @@
+#!/bin/sh
+# usage: build.sh NMLC
+# End-to-end build time of the program from big.sh, with the object
+# encoded directly and through --emit-asm and the assembler, and of the
+# one from nest.sh, best of 5.
+set -e
+nmlc=$(realpath "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+"$(dirname "$0")/big.sh" > "$dir/big.nml"
+"$(dirname "$0")/nest.sh" > "$dir/nest.nml"
+cd "$dir"
+
+# usage: best PATH [FLAG...]
+best() {
+    path=$1
+    shift
+    best=
+    for run in 1 2 3 4 5; do
+        start=$(date +%s%N)
+        "$nmlc" "$@" "$path" > /dev/null
+        ms=$((($(date +%s%N) - start) / 1000000))
+        if [ -z "$best" ] || [ $ms -lt $best ]; then
+            best=$ms
+        fi
+    done
+    echo $best
+}
+
+echo "big ELF:        $(best big.nml) ms"
+echo "big --emit-asm: $(best big.nml --emit-asm) ms"
+echo "nest ELF:       $(best nest.nml) ms"
@@ -0,0 +1,58 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "arena.h"
+#include "env.h"
+#include "sym.h"
+
+// Lookups in an env holding as many globals as a large program would
+#define BENCH_LOOKUPS 2000000
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_lookups(size_t n_globals)
+{
+    arena_t arena;
+    arena_init(&arena);
+
+    sym_t *names = malloc(n_globals * sizeof(sym_t));
+    env_t *env = NULL;
+    for (size_t i = 0; i < n_globals; i++) {
+        char name[32];
+        int len = snprintf(name, sizeof(name), "g%zu", i);
+        names[i] = sym_intern(name, len);
+        env = env_append(&arena, env, names[i], i);
+    }
+
+    // Strided so consecutive lookups do not hit the same path
+    intptr_t sum = 0;
+    double start = bench_now();
+    for (size_t i = 0; i < BENCH_LOOKUPS; i++) {
+        intptr_t value;
+        if (env_find(env, names[i * 7919 % n_globals], &value))
+            sum += value;
+    }
+    double elapsed = bench_now() - start;
+
+    printf("%7zu globals: %6.1f ns/lookup (checksum %ld)\n", n_globals,
+           elapsed / BENCH_LOOKUPS * 1e9, (long)sum);
+
+    free(names);
+    arena_free(&arena);
+}
+
+int main(void)
+{
+    sym_init();
+    bench_lookups(10000);
+    bench_lookups(100000);
+    sym_free();
+    return 0;
+}
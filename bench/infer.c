@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "decl.h"
+#include "infer.h"
+#include "lex.h"
+#include "parse.h"
+#include "sym.h"
+#include "type.h"
+
+#define BENCH_MIN_PAIRS 1000
+#define BENCH_MAX_PAIRS 16000
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// n polymorphic lets, each used at a ground type by the next one, so
+// every generalization and instantiation has work to do
+static char *bench_source(size_t n_pairs, size_t *len)
+{
+    size_t cap = n_pairs * 64 + 256;
+    char *src = calloc(cap + LEX_PADDING, 1);
+
+    *len = snprintf(src, cap, "let puts : Ffi (Str -> ()) = ffi_extern \"puts\";\n"
+                              "let print = \\s -> ffi_call puts s;\n");
+    for (size_t i = 0; i < n_pairs; i++) {
+        *len += snprintf(src + *len, cap - *len, "let f%zu = \\x -> \\y -> x;\nlet g%zu = f%zu 1;\n",
+                         i, i, i);
+    }
+    *len += snprintf(src + *len, cap - *len, "let main = print \"infer\";\n");
+    return src;
+}
+
+static bool bench_infer(size_t n_pairs)
+{
+    size_t len;
+    char *src = bench_source(n_pairs, &len);
+
+    arena_t arena;
+    arena_init(&arena);
+
+    parse_t parse;
+    parse_init(&parse, &arena, src, len);
+
+    decl_t **decls = malloc((2 * n_pairs + 3) * sizeof(decl_t *));
+    size_t n_decls = 0;
+    while (!parse_eof(&parse)) {
+        if (!parse_decl(&parse, &decls[n_decls++]))
+            return false;
+    }
+
+    infer_t infer;
+    infer_init(&infer, &arena, NULL);
+
+    double start = bench_now();
+    for (size_t i = 0; i < n_decls; i++) {
+        if (!infer_decl(&infer, decls[i]))
+            return false;
+    }
+    double elapsed = bench_now() - start;
+
+    printf("%6zu pairs: %8.2f ms, %5.0f ns/let\n", n_pairs, elapsed * 1e3, elapsed / n_decls * 1e9);
+
+    infer_free(&infer);
+    arena_free(&arena);
+    free(decls);
+    free(src);
+    return true;
+}
+
+// With a count, prints the source for that many pairs instead, to feed
+// to nmlc
+int main(int argc, char **argv)
+{
+    if (argc > 1) {
+        size_t len;
+        char *src = bench_source(strtoul(argv[1], NULL, 10), &len);
+        fwrite(src, 1, len, stdout);
+        free(src);
+        return 0;
+    }
+
+    sym_init();
+    type_table_init();
+    for (size_t n = BENCH_MIN_PAIRS; n <= BENCH_MAX_PAIRS; n *= 2) {
+        if (!bench_infer(n)) {
+            printf("Failed to infer %zu pairs\n", n);
+            return 1;
+        }
+    }
+    type_table_free();
+    sym_free();
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lex.h"
+#include "sym.h"
+
+// Lexers from before the padding was required build against this too
+#ifndef LEX_PADDING
+#define LEX_PADDING 0
+#endif
+
+#define BENCH_SIZE (15 << 20)
+#define BENCH_RUNS 5
+
+// Identifiers, keywords, strings, numbers and runs of whitespace in about
+// the mix real source has
+static const char bench_unit[] =
+    "let twice = \\f -> \\x -> f (f x);\n"
+    "let k_combinator = \\x -> \\y -> x; \"a string literal here\"\n"
+    "    let main = \\_ -> print (\"hello world\") ; 12345 :: [a] == b\n\n";
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char *bench_source(size_t *len)
+{
+    size_t unit_len = sizeof(bench_unit) - 1;
+    size_t n_units = BENCH_SIZE / unit_len;
+    char *src = calloc(n_units * unit_len + LEX_PADDING, 1);
+
+    for (size_t i = 0; i < n_units; i++)
+        memcpy(src + i * unit_len, bench_unit, unit_len);
+
+    *len = n_units * unit_len;
+    return src;
+}
+
+// With dump, prints the source instead, to time other lexers on
+int main(int argc, char **argv)
+{
+    size_t len;
+    char *src = bench_source(&len);
+
+    if (argc > 1 && !strcmp(argv[1], "dump")) {
+        fwrite(src, 1, len, stdout);
+        free(src);
+        return 0;
+    }
+
+    sym_init();
+
+    double best = 0;
+    size_t n_tokens = 0;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double start = bench_now();
+
+        lex_t lex;
+        lex_init(&lex, src, len);
+
+        token_t token;
+        n_tokens = 0;
+        do {
+            lex_next(&lex, &token);
+            n_tokens++;
+        } while (token.type != TOK_EOF && token.type != TOK_ERROR);
+
+        double elapsed = bench_now() - start;
+        if (run == 0 || elapsed < best)
+            best = elapsed;
+
+        if (token.type == TOK_ERROR) {
+            printf("Lexing failed after %zu tokens\n", n_tokens);
+            return 1;
+        }
+    }
+
+    printf("%.1f MB, %zu tokens: %.1f MB/s (best of %d)\n", len / 1e6, n_tokens,
+           len / best / 1e6, BENCH_RUNS);
+
+    sym_free();
+    free(src);
+    return 0;
+}
@@ -0,0 +1,23 @@
+#!/bin/sh
+# usage: nest.sh [N]
+# Prints a program with one declaration of N (2000 by default) lambdas,
+# each nested in the one before, for build time and memory with deep
+# nesting.
+n=${1:-2000}
+
+printf '%s\n' 'let puts : Ffi (Str -> ()) = ffi_extern "puts";' \
+    'let print = \s -> ffi_call puts s;'
+printf 'let nest = \\g -> \\s -> '
+i=1
+while [ $i -le $n ]; do
+    printf 'g (\\x%d -> let r%d = print x%d in ' $i $i $i
+    i=$((i + 1))
+done
+printf 's'
+i=0
+while [ $i -lt $n ]; do
+    printf ')'
+    i=$((i + 1))
+done
+printf ';\n'
+printf '%s\n' 'let main = let r = nest (\f -> f "hi") "a" in print r;'
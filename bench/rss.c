@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// usage: rss LIMIT_KB COMMAND...
+// Runs COMMAND and fails if it fails or its peak RSS goes over LIMIT_KB.
+// The collector reserves its heap up front, so limiting the address
+// space with ulimit -v cannot tell a bounded heap from a leaking one.
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        printf("Usage: %s LIMIT_KB COMMAND...\n", argv[0]);
+        return 1;
+    }
+
+    long limit = strtol(argv[1], NULL, 10);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+
+    if (pid == 0) {
+        execvp(argv[2], &argv[2]);
+        perror(argv[2]);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        return 1;
+    }
+
+    printf("%s: peak RSS %ld KB, limit %ld KB\n", argv[2], usage.ru_maxrss, limit);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("%s: Failed\n", argv[2]);
+        return 1;
+    }
+
+    if (usage.ru_maxrss > limit) {
+        printf("%s: Peak RSS over the limit\n", argv[2]);
+        return 1;
+    }
+
+    return 0;
+}
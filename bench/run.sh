@@ -0,0 +1,31 @@
+#!/bin/sh
+# usage: run.sh NMLC PATH...
+# Builds each program and the one from big.sh, then prints the static
+# instruction count of its code and its best run time out of 3.
+set -e
+nmlc=$(realpath "$1")
+shift
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+cp "$@" "$dir"
+"$(dirname "$0")/big.sh" > "$dir/big.nml"
+cd "$dir"
+
+printf '%-12s %8s %8s\n' program insts ms
+for path in "$@" big.nml; do
+    name=$(basename "$path" .nml)
+    "$nmlc" "$name.nml" > /dev/null
+    insts=$(objdump -d "$name.o" | grep -c '^ *[0-9a-f]*:	')
+
+    best=
+    for run in 1 2 3; do
+        start=$(date +%s%N)
+        "./$name" > /dev/null
+        ms=$((($(date +%s%N) - start) / 1000000))
+        if [ -z "$best" ] || [ $ms -lt $best ]; then
+            best=$ms
+        fi
+    done
+    printf '%-12s %8d %8d\n' "$name" "$insts" "$best"
+done
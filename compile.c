@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,67 +7,127 @@
 
 #include "compile.h"
 #include "decl.h"
+#include "emit.h"
 #include "env.h"
 #include "expr.h"
+#include "regalloc.h"
 
 typedef enum {
-    OFF_ARG,
-    OFF_LET,
+    OFF_REG,
     OFF_FV,
     OFF_GLOB,
+    // The expr_t the name is bound to, emitted at each use
+    OFF_CONST,
 } offset_type_t;
 
+// How values of a type are held, from what the type says they can be
+typedef enum {
+    // () has a single value, rebuilt rather than captured
+    REPR_UNIT,
+    // Words that never point to a closure: Int, Str and Ffi
+    REPR_SCALAR,
+    // Closures, or anything a type variable may stand for
+    REPR_CLOSURE,
+} repr_type_t;
+
 #define OFF_GET(o)    (((o) >> 56) & 0xFF)
 #define OFF_SET(o, t) (((uintptr_t)(t) << 56) | (o))
 #define OFF_CLS(o)    ((o) & ~((uintptr_t)0xFF << 56))
 
-void compile_init(compile_t *comp, FILE *file)
+// The closure takes one of the argument registers
+#define COMPILE_MAX_ARITY (IR_MAX_ARGS - 1)
+
+void compile_init(compile_t *comp, arena_t *arena, asm_t *as)
 {
-    comp->file = file;
+    comp->arena = arena;
+    arena_init(&comp->scratch);
+    arena_init(&comp->ir);
+    arena_init(&comp->free);
+    comp->as = as;
+    comp->debug = false;
+    comp->func = NULL;
+    comp->closure = IR_NONE;
+    comp->loaded = NULL;
     comp->lambda_id = 0;
+    comp->partial_id = 0;
     comp->init_id = 0;
-    comp->let_n = 0;
     comp->env = NULL;
+    comp->globals = NULL;
+    comp->known = NULL;
     comp->main = NULL;
     comp->n_strings = 0;
     comp->strings = NULL;
+    comp->n_statics = 0;
+    comp->statics = NULL;
+}
+
+static bool compile_emit_expr(compile_t *comp, expr_t *expr, ir_reg_t *out);
+
+static sym_t compile_label(const char *fmt, ...)
+{
+    char name[32];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(name, sizeof(name), fmt, args);
+    va_end(args);
+    return sym_intern(name, len);
+}
+
+// Functions are built one at a time, their IR is dropped once emitted
+static void compile_func_begin(compile_t *comp, ir_func_t *func, sym_t name)
+{
+    comp->ir_mark = arena_save(&comp->ir);
+    ir_func_init(func, &comp->ir, name);
+    comp->func = func;
+    comp->loaded = NULL;
 }
 
-static bool compile_emit_expr(compile_t *comp, expr_t *expr);
+static void compile_func_end(compile_t *comp)
+{
+    regalloc_func(comp->func);
+
+    if (comp->debug)
+        ir_print(comp->func);
+
+    emit_func(comp->as, comp->func);
+    comp->func = NULL;
+    comp->loaded = NULL;
+    arena_restore(&comp->ir, comp->ir_mark);
+}
 
-static bool compile_emit_var(compile_t *comp, expr_var_t *var)
+static bool compile_emit_var(compile_t *comp, sym_t name, ir_reg_t *out)
 {
     uintptr_t offset;
-    if (env_find(comp->env, var->name, (intptr_t *)&offset) < 0) {
-        printf("Unbound reference to '%s'\n", var->name);
+    if (!env_find(comp->env, name, (intptr_t *)&offset)) {
+        printf("Unbound reference to '%s'\n", sym_name(name));
         return false;
     }
 
     switch (OFF_GET(offset)) {
-        case OFF_ARG:
-            fprintf(comp->file,
-                    "\tmovq %%r14, %%r12\t\t#arg %s\n",
-                    var->name);
+        case OFF_REG:
+            *out = OFF_CLS(offset);
             break;
 
-        case OFF_LET:
-            fprintf(comp->file,
-                    "\tmovq -%lu(%%rbp), %%r12\t\t#let %s\n",
-                    OFF_CLS(offset), var->name);
-            break;
+        case OFF_FV: {
+            // Closures are immutable, so each slot is loaded once
+            intptr_t reg;
+            if (env_find(comp->loaded, name, &reg)) {
+                *out = reg;
+                break;
+            }
 
-        case OFF_FV:
-            fprintf(comp->file,
-                    "\tmovq %lu(%%r13), %%r12\t\t#fv %s\n",
-                    OFF_CLS(offset), var->name);
+            *out = ir_load(comp->func, comp->closure, OFF_CLS(offset));
+            comp->loaded = env_append(&comp->ir, comp->loaded, name, *out);
             break;
+        }
 
         case OFF_GLOB:
-            fprintf(comp->file,
-                    "\tmovq glob_%lu(%%rip), %%r12\t\t#glob %s\n",
-                    OFF_CLS(offset), var->name);
+            *out = ir_load_sym(comp->func, compile_label("glob_%lu", OFF_CLS(offset)));
             break;
 
+        case OFF_CONST:
+            return compile_emit_expr(comp, (expr_t *)OFF_CLS(offset), out);
+
         default:
             return false;
     }
@@ -74,247 +135,590 @@ static bool compile_emit_var(compile_t *comp, expr_var_t *var)
     return true;
 }
 
-static bool compile_freevars(compile_t *comp, expr_t *expr, env_t **env)
+static repr_type_t compile_repr(type_t *type)
+{
+    if (type == NULL || type->tag != TYPE_CON)
+        return REPR_CLOSURE;
+
+    switch (((type_con_t *)type)->name) {
+        case SYM_UNIT:
+            return REPR_UNIT;
+        case SYM_INT:
+        case SYM_STR:
+        case SYM_FFI:
+            return REPR_SCALAR;
+        default:
+            return REPR_CLOSURE;
+    }
+}
+
+// Adds name to the free names in free, mapped to the representation its
+// uses need, the most general one when let-polymorphism gives it several
+// types
+static env_t *compile_free_add(compile_t *comp, env_t *free, sym_t name, intptr_t repr)
+{
+    intptr_t prev;
+    if (env_find(free, name, &prev) && prev >= repr)
+        return free;
+    return env_update(&comp->free, free, name, repr);
+}
+
+static env_t *compile_free_union(compile_t *comp, env_t *a, env_t *b)
+{
+    if (env_length(a) < env_length(b)) {
+        env_t *swap = a;
+        a = b;
+        b = swap;
+    }
+
+    env_iter_t iter;
+    env_iter_init(&iter, b);
+
+    sym_t name;
+    intptr_t repr;
+    while (env_iter_next(&iter, &name, &repr))
+        a = compile_free_add(comp, a, name, repr);
+    return a;
+}
+
+static ir_reg_t compile_alloc(compile_t *comp, size_t size)
+{
+    return ir_alloc(comp->func, size);
+}
+
+// Code pointer and free variables
+static size_t compile_closure_size(expr_lambda_t *lam)
+{
+    return (lam->n_captures + 1) * 8;
+}
+
+// The word the collector finds before the code of a closure: its size,
+// and above it the number of trailing fields it does not scan
+static uint64_t compile_closure_header(size_t size, uint32_t scalars)
+{
+    return (uint64_t)scalars << 32 | size;
+}
+
+// Emits the code for lam taking its closure and the first arity
+// parameters of the lambdas nested in it
+static bool compile_emit_code(compile_t *comp, expr_lambda_t *lam, sym_t name, uint32_t arity)
+{
+    env_t *env = comp->env;
+    arena_mark_t mark = arena_save(&comp->scratch);
+    comp->env = comp->globals;
+
+    env_iter_t iter;
+    sym_t fv;
+    intptr_t value;
+
+    env_iter_init(&iter, lam->consts);
+    while (env_iter_next(&iter, &fv, &value))
+        comp->env = env_update(&comp->scratch, comp->env, fv, value);
+
+    for (uint32_t i = 0; i < lam->n_captures; i++) {
+        comp->env = env_update(&comp->scratch, comp->env, lam->captures[i],
+                               OFF_SET((i + 1) * 8, OFF_FV));
+    }
+
+    ir_func_t func;
+    compile_func_begin(comp, &func, name);
+    comp->closure = ir_param(&func, 0);
+
+    expr_t *body = (expr_t *)lam;
+    for (uint32_t i = 1; i <= arity; i++) {
+        expr_lambda_t *param = (expr_lambda_t *)body;
+        ir_reg_t arg = ir_param(&func, i);
+        comp->env = env_append(&comp->scratch, comp->env, param->bound, OFF_SET(arg, OFF_REG));
+        body = param->body;
+    }
+
+    ir_reg_t result;
+    if (!compile_emit_expr(comp, body, &result))
+        return false;
+
+    ir_ret(&func, result);
+
+    // The collector finds the size of a closure right before its code
+    if (arity == 1)
+        asm_quad(comp->as, compile_closure_header(compile_closure_size(lam), lam->scalars));
+    compile_func_end(comp);
+
+    comp->env = env_clear(comp->env, env);
+    comp->closure = IR_NONE;
+    arena_restore(&comp->scratch, mark);
+    return true;
+}
+
+static bool compile_closed(expr_lambda_t *lam)
+{
+    return lam->n_captures == 0;
+}
+
+// The static record of the closed lambda with the given label
+static sym_t compile_static(sym_t id)
+{
+    return compile_label("%s_closure", sym_name(id));
+}
+
+// The symbol app links to when it is ffi_extern of a literal, the literal
+// may still not be a string
+static bool compile_extern(compile_t *comp, expr_apply_t *app, expr_lit_t **lit)
+{
+    if (app->fun->tag != EXPR_VAR || app->arg->tag != EXPR_LIT)
+        return false;
+
+    expr_var_t *var = (expr_var_t *)app->fun;
+    if (var->name != SYM_FFI_EXTERN || env_find(comp->env, SYM_FFI_EXTERN, NULL))
+        return false;
+
+    *lit = (expr_lit_t *)app->arg;
+    return true;
+}
+
+// What a name bound to expr can stand for instead of a register: literals,
+// externs, compiled closed lambdas and static closures, directly or
+// through another name
+static expr_t *compile_constant(compile_t *comp, expr_t *expr)
 {
     switch (expr->tag) {
         case EXPR_LIT:
-            break;
+            return expr;
 
         case EXPR_VAR: {
-            expr_var_t *var = (expr_var_t *)expr;
-            *env = env_update(*env, var->name, OFF_SET(0, OFF_ARG));
-            break;
+            uintptr_t offset;
+            if (env_find(comp->env, ((expr_var_t *)expr)->name, (intptr_t *)&offset)
+                && OFF_GET(offset) == OFF_CONST)
+                return (expr_t *)OFF_CLS(offset);
+            return NULL;
         }
 
         case EXPR_LAMBDA: {
             expr_lambda_t *lam = (expr_lambda_t *)expr;
-            if (!compile_freevars(comp, lam->body, env))
-                return false;
-
-            *env = env_remove(*env, lam->bound);
-            break;
+            if (lam->id != SYM_NONE && compile_closed(lam))
+                return expr;
+            return NULL;
         }
 
         case EXPR_APPLY: {
             expr_apply_t *app = (expr_apply_t *)expr;
-            return compile_freevars(comp, app->fun, env)
-                && compile_freevars(comp, app->arg, env);
+            expr_lit_t *lit;
+            if (app->id != SYM_NONE
+                || (compile_extern(comp, app, &lit) && lit->kind == LIT_STR))
+                return expr;
+            return NULL;
         }
 
-        case EXPR_LET: {
-            expr_let_t *let = (expr_let_t *)expr;
-            if (!compile_freevars(comp, let->body, env))
-                return false;
+        default:
+            return NULL;
+    }
+}
 
-            *env = env_remove(*env, let->bound);
-            if (!compile_freevars(comp, let->value, env))
-                return false;
+static sym_t compile_string(compile_t *comp, expr_lit_t *lit)
+{
+    // Constants are emitted at each use but stored once
+    if (lit->id == SYM_NONE) {
+        comp->strings = realloc(comp->strings, ++comp->n_strings * sizeof(char *));
+        comp->strings[comp->n_strings - 1] = lit->strv;
+        lit->id = compile_label("str_%zu", comp->n_strings - 1);
+    }
+    return lit->id;
+}
+
+// Externs are only known through their GOT slot, which data cannot hold
+static bool compile_storable(expr_t *constant)
+{
+    return constant->tag != EXPR_APPLY || ((expr_apply_t *)constant)->id != SYM_NONE;
+}
 
-            comp->let_n++;
+// The word of a storable constant in a static closure
+static void compile_static_field(compile_t *comp, expr_t *constant)
+{
+    switch (constant->tag) {
+        case EXPR_LIT: {
+            expr_lit_t *lit = (expr_lit_t *)constant;
+            if (lit->kind == LIT_STR)
+                asm_quad_sym(comp->as, compile_string(comp, lit));
+            else
+                asm_quad(comp->as, lit->kind == LIT_INT ? lit->intv : 0);
             break;
         }
+
+        case EXPR_LAMBDA:
+            asm_quad_sym(comp->as, compile_static(((expr_lambda_t *)constant)->id));
+            break;
+
+        case EXPR_APPLY:
+            asm_quad_sym(comp->as, ((expr_apply_t *)constant)->id);
+            break;
+
+        default:
+            break;
     }
-    return true;
 }
 
-static bool compile_emit_lambda(compile_t *comp, expr_lambda_t *lam)
+// Applying a closed lambda to fewer constants than it takes only builds
+// the closure of a lambda nested in it, which is then made static and
+// labelled in app->id
+static void compile_static_apply(compile_t *comp, expr_apply_t *app)
 {
-    if (lam->id != NULL) {
-        size_t n_freevars = env_length(lam->freevars);
+    expr_t *args[COMPILE_MAX_ARITY];
+    uint32_t n_args = 0;
 
-        fprintf(comp->file,
-                "\tmovq $%ld, %%rdi\n"
-                "\tcall malloc\n"
-                "\tmovq %%rax, %%r15\n"
-                "\tleaq %s(%%rip), %%rax\n"
-                "\tmovq %%rax, (%%r15)\n",
-                (n_freevars + 1) * 8,
-                lam->id);
+    // Arguments come out last first
+    expr_apply_t *inner = app;
+    for (;;) {
+        if (n_args == COMPILE_MAX_ARITY)
+            return;
 
-        for (env_t *env = lam->freevars; env; env = env->next) {
-            expr_var_t var = { 0 };
-            var.name = strdup(env->name);
+        expr_t *arg = compile_constant(comp, inner->arg);
+        if (arg == NULL || !compile_storable(arg))
+            return;
+        args[n_args++] = arg;
 
-            if (!compile_emit_var(comp, &var))
-                return false;
+        if (inner->fun->tag != EXPR_APPLY)
+            break;
+        inner = (expr_apply_t *)inner->fun;
+    }
 
-            if (OFF_GET(env->value) != OFF_FV)
-                return false;
+    expr_lambda_t *lam = inner->known;
+    if (lam == NULL || lam->id == SYM_NONE || !compile_closed(lam))
+        return;
 
-            fprintf(comp->file,
-                    "\tmovq %%r12, %ld(%%r15)\n",
-                    OFF_CLS(env->value));
-        }
+    sym_t params[COMPILE_MAX_ARITY];
+    for (uint32_t i = 0; i < n_args; i++) {
+        if (lam->body->tag != EXPR_LAMBDA)
+            return;
+        params[n_args - 1 - i] = lam->bound;
+        lam = (expr_lambda_t *)lam->body;
+    }
 
-        fputs("\tmovq %r15, %r12\n\n", comp->file);
-        return true;
+    if (compile_closed(lam)) {
+        app->id = compile_static(lam->id);
+        return;
     }
 
-    char *id = malloc(16);
-    snprintf(id, 16, "lambda_%u", comp->lambda_id++);
-    lam->id = id;
+    // The lambda left can only capture the parameters, the innermost of
+    // any with the same name
+    arena_mark_t mark = arena_save(&comp->scratch);
+    size_t n_fields = lam->n_captures;
+    expr_t **fields = arena_calloc(&comp->scratch, n_fields, sizeof(expr_t *));
 
-    comp->let_n = 0;
-    env_t *freevars = NULL;
-    if (!compile_freevars(comp, (expr_t *)lam, &freevars)) {
-        printf("Failed to get freevars\n");
-        return false;
+    for (size_t field = 0; field < n_fields; field++) {
+        for (uint32_t i = 0; i < n_args && !fields[field]; i++) {
+            if (params[i] == lam->captures[field])
+                fields[field] = args[i];
+        }
     }
 
-    // TODO: Add a list of ignored values
-    freevars = env_remove(freevars, "ffi_call");
+    app->id = compile_label("partial_%u", comp->partial_id++);
+    asm_section(comp->as, ASM_DATA);
+    asm_label(comp->as, app->id);
+    asm_quad_sym(comp->as, lam->id);
+
+    for (size_t i = 0; i < n_fields; i++)
+        compile_static_field(comp, fields[i]);
+    asm_section(comp->as, ASM_TEXT);
+    arena_restore(&comp->scratch, mark);
+}
 
-    size_t let_n = comp->let_n;
-    comp->let_n = 0;
+// Binds name to a constant when value is one, or to reg
+static env_t *compile_bind(compile_t *comp, env_t *env, sym_t name, expr_t *value, ir_reg_t reg)
+{
+    expr_t *constant = compile_constant(comp, value);
+    if (constant)
+        return env_append(&comp->scratch, env, name, OFF_SET((uintptr_t)constant, OFF_CONST));
+    return env_append(&comp->scratch, env, name, OFF_SET(reg, OFF_REG));
+}
 
-    size_t offset = 8;
-    for (env_t *fv = freevars; fv; fv = fv->next) {
-        fv->value = OFF_SET(offset, OFF_FV);
-        offset += 8;
+// Closure converts lam given the names free in it. Globals are read from
+// their symbol and constants rebuilt rather than captured, () being one,
+// the rest get a field each.
+static void compile_convert(compile_t *comp, expr_lambda_t *lam, env_t *free)
+{
+    sym_t *captures = arena_alloc(comp->arena, env_length(free) * sizeof(sym_t));
+    uint32_t n_captures = 0;
+
+    // Fields that may point to closures come first, so the collector
+    // scans a prefix
+    env_iter_t iter;
+    sym_t name;
+    intptr_t repr;
+    for (intptr_t scan = REPR_CLOSURE; scan >= REPR_UNIT; scan--) {
+        env_iter_init(&iter, free);
+        while (env_iter_next(&iter, &name, &repr)) {
+            // TODO: Add a list of ignored values
+            if (repr != scan || name == SYM_FFI_CALL)
+                continue;
+
+            intptr_t value = OFF_SET(0, OFF_FV);
+            if (repr == REPR_UNIT)
+                value = OFF_SET((uintptr_t)expr_lit_new_unit(comp->arena), OFF_CONST);
+            else
+                env_find(comp->env, name, &value);
+
+            if (OFF_GET(value) == OFF_CONST) {
+                lam->consts = env_append(comp->arena, lam->consts, name, value);
+            } else if (OFF_GET(value) != OFF_GLOB) {
+                captures[n_captures++] = name;
+                lam->scalars += scan == REPR_SCALAR;
+            }
+        }
     }
 
-    env_t *env = comp->env;
-    comp->env = env_append(freevars, lam->bound, OFF_SET(0, OFF_ARG));
+    lam->captures = captures;
+    lam->n_captures = n_captures;
+}
+
+// Emits the code of a closure converted lambda, and the entry taking all
+// its parameters at once
+static bool compile_emit_entries(compile_t *comp, expr_lambda_t *lam)
+{
+    lam->id = compile_label("lambda_%u", comp->lambda_id++);
+    if (!compile_emit_code(comp, lam, lam->id, 1))
+        return false;
 
-    fprintf(comp->file, "%s:\n", id);
-    if (let_n) {
-        fprintf(comp->file,
-                "\tpushq %%rbp\n"
-                "\tmovq %%rsp, %%rbp\n"
-                "\tsubq $%ld, %%rsp\n"
-                "\n",
-                let_n * 8);
+    // Saturated calls skip the intermediate closures
+    if (lam->arity > 1) {
+        lam->entry = compile_label("%s_%u", sym_name(lam->id), lam->arity);
+        if (!compile_emit_code(comp, lam, lam->entry, lam->arity))
+            return false;
     }
 
-    if (!compile_emit_expr(comp, lam->body))
-        return false;
+    // Closed lambdas are the same every time, so they are allocated once
+    // and for all
+    if (compile_closed(lam)) {
+        comp->statics = realloc(comp->statics, ++comp->n_statics * sizeof(sym_t));
+        comp->statics[comp->n_statics - 1] = lam->id;
+    }
 
-    lam->freevars = env_clear(comp->env, freevars);
-    comp->env = env;
+    return true;
+}
+
+static bool compile_emit_lambda(compile_t *comp, expr_lambda_t *lam, ir_reg_t *out)
+{
+    if (compile_closed(lam)) {
+        *out = ir_addr(comp->func, compile_static(lam->id));
+        return true;
+    }
 
-    if (let_n)
-        fputs("\tleave\n", comp->file);
+    ir_reg_t closure = lam->stack
+        ? ir_frame(comp->func, compile_closure_size(lam))
+        : compile_alloc(comp, compile_closure_size(lam));
+    ir_store(comp->func, closure, 0, ir_addr(comp->func, lam->id));
 
-    fputs("\tret\n\n", comp->file);
+    for (uint32_t i = 0; i < lam->n_captures; i++) {
+        ir_reg_t reg;
+        if (!compile_emit_var(comp, lam->captures[i], &reg))
+            return false;
+        ir_store(comp->func, closure, (i + 1) * 8, reg);
+    }
+
+    *out = closure;
     return true;
 }
 
-static bool compile_emit_lit(compile_t *comp, expr_lit_t *lit)
+static bool compile_emit_lit(compile_t *comp, expr_lit_t *lit, ir_reg_t *out)
 {
     if (lit->kind == LIT_STR) {
-        comp->strings = realloc(comp->strings, ++comp->n_strings * sizeof(char *));
-        comp->strings[comp->n_strings - 1] = lit->strv;
-        fprintf(comp->file, "\tleaq str_%zu(%%rip), %%r12\n", comp->n_strings - 1);
+        *out = ir_addr(comp->func, compile_string(comp, lit));
     } else if (lit->kind == LIT_INT) {
-        fprintf(comp->file, "\tmovq $%ld, %%r12\n", lit->intv);
+        *out = ir_imm(comp->func, lit->intv);
+    } else {
+        *out = ir_imm(comp->func, 0);
     }
-    // do nothing on unit
     return true;
 }
 
-static bool compile_emit_apply(compile_t *comp, expr_apply_t *app)
+// A call that gives a known lambda all its parameters, args gets them in
+// order
+static expr_lambda_t *compile_saturated(expr_apply_t *app, expr_t **args)
 {
-    bool ffi_call = false;
-    if (app->fun->tag == EXPR_VAR) {
-        expr_var_t *var = (expr_var_t *)app->fun;
+    expr_t *expr = (expr_t *)app;
+    uint32_t n_args = 0;
 
-        if (!strcmp(var->name, "ffi_extern") &&
-            env_find(comp->env, "ffi_extern", NULL) < 0) {
-            if (app->arg->tag == EXPR_LIT) {
-                expr_lit_t *lit = (expr_lit_t *)app->arg;
-                if (lit->kind != LIT_STR) {
-                    printf("Expected known string for ffi_extern\n");
-                    return false;
-                }
+    while (expr->tag == EXPR_APPLY && n_args < COMPILE_MAX_ARITY) {
+        expr_apply_t *inner = (expr_apply_t *)expr;
+        n_args++;
+
+        expr_lambda_t *lam = inner->known;
+        if (lam) {
+            if (lam->arity != n_args)
+                return NULL;
 
-                fprintf(comp->file,
-                        "\t.extern %s\n"
-                        "\tleaq %s@GOTPCREL(%%rip), %%r12\n",
-                        lit->strv,
-                        lit->strv);
-                return true;
+            for (uint32_t i = 0; i < n_args; i++) {
+                args[n_args - 1 - i] = app->arg;
+                app = (expr_apply_t *)app->fun;
             }
+            return lam;
         }
 
-        ffi_call = !strcmp(var->name, "ffi_call")
-            && env_find(comp->env, "ffi_call", NULL) < 0;
+        expr = inner->fun;
     }
 
-    if (!ffi_call) {
-        if (!compile_emit_expr(comp, app->fun))
+    return NULL;
+}
+
+static bool compile_emit_saturated(compile_t *comp, expr_apply_t *app, expr_lambda_t *lam,
+                                   expr_t **args, ir_reg_t *out)
+{
+    ir_reg_t regs[IR_MAX_ARGS];
+    regs[0] = IR_NONE;
+
+    expr_t *fun = app->fun;
+    for (uint32_t i = 1; i < lam->arity; i++)
+        fun = ((expr_apply_t *)fun)->fun;
+
+    if (!compile_closed(lam) && !compile_emit_expr(comp, fun, &regs[0]))
+        return false;
+
+    for (uint32_t i = 0; i < lam->arity; i++) {
+        if (!compile_emit_expr(comp, args[i], &regs[i + 1]))
             return false;
-        fputs("\tpushq %r12\n", comp->file);
     }
 
-    if (!compile_emit_expr(comp, app->arg))
+    *out = ir_call_sym(comp->func, lam->entry, lam->arity + 1, regs);
+    return true;
+}
+
+// Whether expr is the builtin ffi_call, not shadowed by a local
+static bool compile_ffi_call(compile_t *comp, expr_t *expr)
+{
+    return expr->tag == EXPR_VAR && ((expr_var_t *)expr)->name == SYM_FFI_CALL
+        && !env_find(comp->env, SYM_FFI_CALL, NULL);
+}
+
+static bool compile_emit_apply(compile_t *comp, expr_apply_t *app, ir_reg_t *out)
+{
+    if (app->id != SYM_NONE) {
+        *out = ir_addr(comp->func, app->id);
+        return true;
+    }
+
+    expr_t *args[COMPILE_MAX_ARITY];
+    expr_lambda_t *saturated = compile_saturated(app, args);
+    if (saturated && saturated->arity > 1)
+        return compile_emit_saturated(comp, app, saturated, args, out);
+
+    expr_lit_t *lit;
+    if (compile_extern(comp, app, &lit)) {
+        if (lit->kind != LIT_STR) {
+            printf("Expected known string for ffi_extern\n");
+            return false;
+        }
+
+        sym_t name = sym_intern(lit->strv, strlen(lit->strv));
+        asm_extern(comp->as, name);
+        *out = ir_got(comp->func, name);
+        return true;
+    }
+
+    // ffi_call with both arguments calls the C function directly
+    if (app->fun->tag == EXPR_APPLY && compile_ffi_call(comp, ((expr_apply_t *)app->fun)->fun)) {
+        ir_reg_t slot, arg;
+        if (!compile_emit_expr(comp, ((expr_apply_t *)app->fun)->arg, &slot)
+            || !compile_emit_expr(comp, app->arg, &arg))
+            return false;
+
+        *out = ir_call_c(comp->func, slot, arg);
+        return true;
+    }
+
+    bool ffi_call = compile_ffi_call(comp, app->fun);
+
+    // Known callees are called by label, and closed ones need no closure
+    // at all
+    expr_lambda_t *known = app->known;
+
+    ir_reg_t fun = IR_NONE;
+    if (!ffi_call && !(known && compile_closed(known)) &&
+        !compile_emit_expr(comp, app->fun, &fun))
+        return false;
+
+    ir_reg_t arg;
+    if (!compile_emit_expr(comp, app->arg, &arg))
         return false;
 
     if (ffi_call) {
-        fprintf(comp->file,
-                "\tmovq $16, %%rdi\n"
-                "\tcall malloc\n"
-                "\tmovq %%rax, %%r15\n"
-                "\tleaq ffi_call(%%rip), %%rax\n"
-                "\tmovq %%rax, (%%r15)\n"
-                "\tmovq %%r12, 8(%%r15)\n"
-                "\tmovq %%r15, %%r12\n\n");
+        ir_reg_t closure = compile_alloc(comp, 16);
+        ir_store(comp->func, closure, 0, ir_addr(comp->func, SYM_FFI_CALL));
+        ir_store(comp->func, closure, 8, arg);
+        *out = closure;
+    } else if (known) {
+        *out = ir_call_sym(comp->func, known->id, 2, (ir_reg_t[]){ fun, arg });
     } else {
-        fputs("\tmovq %r12, %r14\n"
-              "\tpopq %r13\n"
-              "\tcall *(%r13)\n"
-              "\n",
-              comp->file);
+        *out = ir_call(comp->func, fun, arg);
     }
 
     return true;
 }
 
-static bool compile_emit_let(compile_t *comp, expr_let_t *let)
+static bool compile_emit_let(compile_t *comp, expr_let_t *let, ir_reg_t *out)
 {
-    if (!compile_emit_expr(comp, let->value))
+    ir_reg_t value = IR_NONE;
+    if (!compile_constant(comp, let->value) && !compile_emit_expr(comp, let->value, &value))
         return false;
 
     env_t *env = comp->env;
-    comp->env = env_append(env, let->bound, OFF_SET(++comp->let_n * 8, OFF_LET));
+    arena_mark_t mark = arena_save(&comp->scratch);
+    comp->env = compile_bind(comp, env, let->bound, let->value, value);
 
-    fprintf(comp->file, "\tmovq %%r12, -%ld(%%rbp)\n", comp->let_n * 8);
-    if (!compile_emit_expr(comp, let->body))
+    if (!compile_emit_expr(comp, let->body, out))
         return false;
 
     comp->env = env_clear(comp->env, env);
-    comp->env = env;
-    comp->let_n--;
+    arena_restore(&comp->scratch, mark);
     return true;
 }
 
-static bool compile_emit_expr(compile_t *comp, expr_t *expr)
+static bool compile_emit_expr(compile_t *comp, expr_t *expr, ir_reg_t *out)
 {
     switch (expr->tag) {
         case EXPR_LIT:
-            return compile_emit_lit(comp, (expr_lit_t *)expr);
+            return compile_emit_lit(comp, (expr_lit_t *)expr, out);
 
         case EXPR_VAR:
-            return compile_emit_var(comp, (expr_var_t *)expr);
+            return compile_emit_var(comp, ((expr_var_t *)expr)->name, out);
 
         case EXPR_LAMBDA: {
             expr_lambda_t *lam = (expr_lambda_t *)expr;
-            return compile_emit_lambda(comp, lam);
+            return compile_emit_lambda(comp, lam, out);
         }
 
         case EXPR_APPLY: {
             expr_apply_t *app = (expr_apply_t *)expr;
-            return compile_emit_apply(comp, app);
+            return compile_emit_apply(comp, app, out);
         }
 
         case EXPR_LET: {
             expr_let_t *let = (expr_let_t *)expr;
-            return compile_emit_let(comp, let);
+            return compile_emit_let(comp, let, out);
         }
     }
     return true;
 }
 
-static bool compile_lambdas(compile_t *comp, expr_t *expr)
+// The lambda expr evaluates to when it is a lambda or a variable bound to
+// one
+static expr_lambda_t *compile_known_value(expr_t *expr, env_t *known)
+{
+    intptr_t lam;
+    if (expr->tag == EXPR_LAMBDA)
+        return (expr_lambda_t *)expr;
+    if (expr->tag == EXPR_VAR && env_find(known, ((expr_var_t *)expr)->name, &lam))
+        return (expr_lambda_t *)lam;
+    return NULL;
+}
+
+static env_t *compile_known_bind(arena_t *arena, env_t *known, sym_t name, expr_lambda_t *lam)
+{
+    if (lam)
+        return env_update(arena, known, name, (intptr_t)lam);
+    return env_remove(arena, known, name);
+}
+
+// Marks applications whose callee is a variable bound to a lambda, known
+// maps names in scope to their lambda. Also finds the arity of lambdas.
+static void compile_known(compile_t *comp, expr_t *expr, env_t *known)
 {
     switch (expr->tag) {
         case EXPR_LIT:
@@ -323,29 +727,208 @@ static bool compile_lambdas(compile_t *comp, expr_t *expr)
 
         case EXPR_LAMBDA: {
             expr_lambda_t *lam = (expr_lambda_t *)expr;
-            env_t *env = comp->env;
+            known = env_remove(&comp->scratch, known, lam->bound);
+            compile_known(comp, lam->body, known);
+
+            // Directly nested lambdas can take their parameters at once
+            lam->arity = 1;
+            if (lam->body->tag == EXPR_LAMBDA) {
+                expr_lambda_t *body = (expr_lambda_t *)lam->body;
+                if (body->arity < COMPILE_MAX_ARITY)
+                    lam->arity += body->arity;
+                else
+                    lam->arity = COMPILE_MAX_ARITY;
+            }
+            break;
+        }
 
-            comp->env = env_append(env, lam->bound, OFF_SET(0, OFF_ARG));
-            if (!compile_lambdas(comp, lam->body))
-                return false;
+        case EXPR_APPLY: {
+            expr_apply_t *app = (expr_apply_t *)expr;
+            if (app->fun->tag == EXPR_VAR)
+                app->known = compile_known_value(app->fun, known);
 
-            if (!compile_emit_lambda(comp, lam))
-                return false;
+            compile_known(comp, app->fun, known);
+            compile_known(comp, app->arg, known);
+            break;
+        }
+
+        case EXPR_LET: {
+            expr_let_t *let = (expr_let_t *)expr;
+            compile_known(comp, let->value, known);
+
+            expr_lambda_t *lam = compile_known_value(let->value, known);
+            known = compile_known_bind(&comp->scratch, known, let->bound, lam);
+            compile_known(comp, let->body, known);
+            break;
+        }
+    }
+}
+
+static void compile_escaped(compile_t *comp, env_t **escaped, sym_t name)
+{
+    *escaped = env_update(&comp->scratch, *escaped, name, 0);
+}
+
+// Finds the closures that never outlive the function building them, and
+// the parameters of each entry that may outlive a call to it. depths maps
+// local names to the nesting of the closures whose code binds them, a use
+// any deeper is captured. Names that may escape by being the value of
+// their function, captured, or passed to a call that may keep them are
+// added to escaped. Calling a closure never lets it out, its code only
+// reads its fields.
+static void compile_escape(compile_t *comp, expr_t *expr, env_t *depths, intptr_t depth,
+                           bool value, env_t **escaped)
+{
+    switch (expr->tag) {
+        case EXPR_LIT:
+            break;
+
+        case EXPR_VAR: {
+            sym_t name = ((expr_var_t *)expr)->name;
+            intptr_t bound;
+            if (env_find(depths, name, &bound) && (value || bound < depth))
+                compile_escaped(comp, escaped, name);
+            break;
+        }
+
+        case EXPR_LAMBDA: {
+            expr_lambda_t *lam = (expr_lambda_t *)expr;
+
+            // The entry binds all its parameters in one function
+            depth++;
+            expr_t *body = expr;
+            for (uint32_t i = 0; i < lam->arity; i++) {
+                expr_lambda_t *param = (expr_lambda_t *)body;
+                depths = env_append(&comp->scratch, depths, param->bound, depth);
+                body = param->body;
+            }
+            compile_escape(comp, body, depths, depth, true, escaped);
+
+            // The lambdas nested in the entry have entries of their own over
+            // the rest of its parameters, unless the arity was capped
+            bool capped = body->tag == EXPR_LAMBDA;
+            body = expr;
+            for (uint32_t i = 0; i < lam->arity; i++) {
+                expr_lambda_t *inner = (expr_lambda_t *)body;
+                inner->escapes = capped ? UINT32_MAX : 0;
+
+                expr_t *param = body;
+                for (uint32_t j = i; !capped && j < lam->arity; j++) {
+                    sym_t name = ((expr_lambda_t *)param)->bound;
+                    if (env_find(*escaped, name, NULL))
+                        inner->escapes |= 1u << (j - i);
+                    param = ((expr_lambda_t *)param)->body;
+                }
+                body = inner->body;
+            }
+            break;
+        }
+
+        case EXPR_APPLY: {
+            expr_apply_t *app = (expr_apply_t *)expr;
+            expr_t *args[COMPILE_MAX_ARITY];
+
+            expr_lambda_t *lam = compile_saturated(app, args);
+            if (lam == NULL) {
+                compile_escape(comp, app->fun, depths, depth, false, escaped);
+                compile_escape(comp, app->arg, depths, depth, true, escaped);
+                break;
+            }
+
+            expr_t *fun = app->fun;
+            for (uint32_t i = 1; i < lam->arity; i++)
+                fun = ((expr_apply_t *)fun)->fun;
+            compile_escape(comp, fun, depths, depth, false, escaped);
+
+            // Closures built for a parameter that stays in the call can
+            // live in the frame
+            for (uint32_t i = 0; i < lam->arity; i++) {
+                bool kept = lam->escapes & 1u << i;
+                compile_escape(comp, args[i], depths, depth, kept, escaped);
+                if (args[i]->tag == EXPR_LAMBDA)
+                    ((expr_lambda_t *)args[i])->stack = !kept;
+            }
+            break;
+        }
+
+        case EXPR_LET: {
+            expr_let_t *let = (expr_let_t *)expr;
+            compile_escape(comp, let->value, depths, depth, true, escaped);
+
+            depths = env_append(&comp->scratch, depths, let->bound, depth);
+            compile_escape(comp, let->body, depths, depth, value, escaped);
+
+            if (let->value->tag == EXPR_LAMBDA)
+                ((expr_lambda_t *)let->value)->stack = !env_find(*escaped, let->bound, NULL);
+            break;
+        }
+    }
+}
+
+// Closure converts and emits the lambdas in expr, innermost first. Sets
+// free to the names free in expr, in comp->free, so each lambda finds
+// its own from its body's.
+static bool compile_lambdas(compile_t *comp, expr_t *expr, env_t **free)
+{
+    switch (expr->tag) {
+        case EXPR_LIT:
+            *free = NULL;
+            break;
+
+        case EXPR_VAR:
+            *free = compile_free_add(comp, NULL, ((expr_var_t *)expr)->name,
+                                     compile_repr(expr->type));
+            break;
+
+        case EXPR_LAMBDA: {
+            expr_lambda_t *lam = (expr_lambda_t *)expr;
+            env_t *env = comp->env;
+            arena_mark_t mark = arena_save(&comp->scratch);
 
+            comp->env = env_append(&comp->scratch, env, lam->bound, OFF_SET(IR_NONE, OFF_REG));
+            if (!compile_lambdas(comp, lam->body, free))
+                return false;
             comp->env = env_clear(comp->env, env);
-            return true;
+            arena_restore(&comp->scratch, mark);
+
+            *free = env_remove(&comp->free, *free, lam->bound);
+            compile_convert(comp, lam, *free);
+            return compile_emit_entries(comp, lam);
         }
 
         case EXPR_APPLY: {
             expr_apply_t *app = (expr_apply_t *)expr;
-            return compile_lambdas(comp, app->fun)
-                && compile_lambdas(comp, app->arg);
+            env_t *arg;
+            if (!compile_lambdas(comp, app->fun, free) || !compile_lambdas(comp, app->arg, &arg))
+                return false;
+
+            *free = compile_free_union(comp, *free, arg);
+            break;
         }
 
         case EXPR_LET: {
             expr_let_t *let = (expr_let_t *)expr;
-            return compile_lambdas(comp, let->value)
-                && compile_lambdas(comp, let->body);
+            env_t *value;
+            if (!compile_lambdas(comp, let->value, &value))
+                return false;
+            if (let->value->tag == EXPR_APPLY)
+                compile_static_apply(comp, (expr_apply_t *)let->value);
+
+            // The body sees which names are constants, and that the bound
+            // name shadows any global
+            env_t *env = comp->env;
+            arena_mark_t mark = arena_save(&comp->scratch);
+            comp->env = compile_bind(comp, env, let->bound, let->value, IR_NONE);
+
+            if (!compile_lambdas(comp, let->body, free))
+                return false;
+
+            comp->env = env_clear(comp->env, env);
+            arena_restore(&comp->scratch, mark);
+
+            *free = env_remove(&comp->free, *free, let->bound);
+            *free = compile_free_union(comp, *free, value);
+            break;
         }
     }
 
@@ -359,25 +942,57 @@ bool compile_decl(compile_t *comp, decl_t *decl)
 
     decl_let_t *let = (decl_let_t *)decl;
 
-    if (!strcmp(let->bound, "main"))
+    if (let->bound == SYM_MAIN)
         comp->main = let;
 
-    if (!compile_lambdas(comp, let->value))
+    arena_mark_t mark = arena_save(&comp->scratch);
+    compile_known(comp, let->value, comp->known);
+
+    env_t *escaped = NULL;
+    compile_escape(comp, let->value, NULL, 0, true, &escaped);
+    arena_restore(&comp->scratch, mark);
+
+    env_t *free;
+    mark = arena_save(&comp->free);
+    bool ok = compile_lambdas(comp, let->value, &free);
+    arena_restore(&comp->free, mark);
+
+    if (!ok)
         return false;
+    if (let->value->tag == EXPR_APPLY)
+        compile_static_apply(comp, (expr_apply_t *)let->value);
+
+    // Constants need no init, uses rebuild them instead of loading
+    // their global. main is always run.
+    expr_t *constant = compile_constant(comp, let->value);
+    if (constant && let->bound != SYM_MAIN) {
+        comp->env = env_append(comp->arena, comp->env, let->bound,
+                               OFF_SET((uintptr_t)constant, OFF_CONST));
+        comp->globals = comp->env;
+
+        expr_lambda_t *lam = compile_known_value(let->value, comp->known);
+        comp->known = compile_known_bind(comp->arena, comp->known, let->bound, lam);
+        return true;
+    }
 
     let->id = comp->init_id++;
-    fprintf(comp->file, "init_%u:\n", let->id);
 
-    if (!compile_emit_expr(comp, let->value))
+    ir_func_t func;
+    compile_func_begin(comp, &func, compile_label("init_%u", let->id));
+
+    ir_reg_t value;
+    if (!compile_emit_expr(comp, let->value, &value))
         return false;
 
-    fprintf(comp->file,
-            "\tmovq %%r12, glob_%u(%%rip)\n"
-            "\tret\n"
-            "\n",
-            let->id);
+    ir_store_sym(&func, compile_label("glob_%u", let->id), value);
+    ir_ret(&func, IR_NONE);
+    compile_func_end(comp);
 
-    comp->env = env_append(comp->env, let->bound, OFF_SET(let->id, OFF_GLOB));
+    comp->env = env_append(comp->arena, comp->env, let->bound, OFF_SET(let->id, OFF_GLOB));
+    comp->globals = comp->env;
+
+    expr_lambda_t *lam = compile_known_value(let->value, comp->known);
+    comp->known = compile_known_bind(comp->arena, comp->known, let->bound, lam);
     return true;
 }
 
@@ -386,63 +1001,68 @@ bool compile_main(compile_t *comp)
     if (comp->main == NULL)
         return false;
 
-    fputs(".extern malloc\n"
-          ".globl main\n"
-          "main:\n"
-          "\tpushq %rbp\n"
-          "\tmovq %rsp, %rbp\n"
-          "\tpushq %r12\n"
-          "\tpushq %r13\n"
-          "\tpushq %r14\n"
-          "\tpushq %r15\n",
-          comp->file);
+    asm_t *as = comp->as;
+
+    ir_func_t func;
+    compile_func_begin(comp, &func, SYM_MAIN);
+    func.global = true;
 
     for (uint32_t i = 0; i < comp->init_id; i++) {
         if (comp->main->id == i) continue;
-        fprintf(comp->file, "\tcall init_%u\n", i);
-    }
-
-    fprintf(comp->file, "\tcall init_%u\t\t#main\n", comp->main->id);
-
-    fputs("\tpopq %r15\n"
-          "\tpopq %r14\n"
-          "\tpopq %r13\n"
-          "\tpopq %r12\n"
-          "\txorq %rax, %rax\n"
-          "\tleave\n"
-          "\tret\n"
-          "\n"
-          "ffi_call:\n"
-          "\tmovq 8(%r13), %rax\n"
-          "\tmovq %r14, %rdi\n"
-          "\tcall *(%rax)\n"
-          "\tmovq %rax, %r12\n"
-          "\tret\n"
-          "\n"
-          ".section .note.GNU-stack,\"\",@progbits\n"
-          "\n"
-          ".section .bss\n"
-          ".align 8\n",
-          comp->file);
+        ir_call_sym(&func, compile_label("init_%u", i), 0, NULL);
+    }
+
+    ir_call_sym(&func, compile_label("init_%u", comp->main->id), 0, NULL);
+    ir_ret(&func, ir_imm(&func, 0));
+    compile_func_end(comp);
+
+    // Calls the C function in the closure's slot with the argument
+    asm_quad(as, compile_closure_header(16, 1));
+    asm_label(as, SYM_FFI_CALL);
+    asm_load(as, ASM_RAX, ASM_RDI, 8);
+    asm_mov(as, ASM_RDI, ASM_RSI);
+    asm_jmp_mem(as, ASM_RAX, 0);
+
+    sym_t globals = compile_label("globals");
+    sym_t globals_end = compile_label("globals_end");
+    emit_runtime(as, globals, globals_end);
+
+    asm_section(as, ASM_BSS);
+    asm_align(as, 8);
+    asm_label(as, globals);
 
     for (uint32_t i = 0; i < comp->init_id; i++) {
-        fprintf(comp->file, "glob_%u: .skip 8\n", i);
+        asm_label(as, compile_label("glob_%u", i));
+        asm_skip(as, 8);
+    }
+
+    asm_label(as, globals_end);
+
+    asm_section(as, ASM_DATA);
+    asm_align(as, 8);
+
+    for (size_t i = 0; i < comp->n_statics; i++) {
+        asm_label(as, compile_static(comp->statics[i]));
+        asm_quad_sym(as, comp->statics[i]);
     }
 
-    fputs("\n"
-          ".section .rodata\n"
-          ".align 8\n",
-          comp->file);
+    asm_section(as, ASM_RODATA);
+    asm_align(as, 8);
 
     for (size_t i = 0; i < comp->n_strings; i++) {
-        fprintf(comp->file, "str_%zu: .asciz \"%s\\0\"\n",
-                i, comp->strings[i]);
+        asm_label(as, compile_label("str_%zu", i));
+        asm_string(as, comp->strings[i]);
     }
 
-    return true;
+    return asm_finish(as);
 }
 
 void compile_free(compile_t *comp)
 {
-    env_clear(comp->env, NULL);
+    comp->env = env_clear(comp->env, NULL);
+    arena_free(&comp->scratch);
+    arena_free(&comp->ir);
+    arena_free(&comp->free);
+    free(comp->strings);
+    free(comp->statics);
 }
@@ -6,21 +6,37 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "arena.h"
+#include "asm.h"
 #include "decl.h"
 #include "env.h"
+#include "ir.h"
 
 typedef struct {
-    FILE *file;
+    arena_t *arena;
+    arena_t scratch;
+    arena_t ir;
+    arena_mark_t ir_mark;
+    arena_t free;
+    asm_t *as;
+    bool debug;
+    ir_func_t *func;
+    ir_reg_t closure;
+    env_t *loaded;
     uint32_t lambda_id;
+    uint32_t partial_id;
     uint32_t init_id;
-    long let_n;
     env_t *env;
+    env_t *globals;
+    env_t *known;
     decl_let_t *main;
     size_t n_strings;
     const char **strings;
+    size_t n_statics;
+    sym_t *statics;
 } compile_t;
 
-void compile_init(compile_t *comp, FILE *file);
+void compile_init(compile_t *comp, arena_t *arena, asm_t *as);
 
 bool compile_decl(compile_t *comp, decl_t *decl);
 
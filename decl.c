@@ -2,9 +2,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-decl_t *decl_let_new(char *bound, expr_t *value)
+decl_t *decl_let_new(arena_t *arena, sym_t bound, expr_t *value)
 {
-    decl_let_t *decl = calloc(1, sizeof(decl_let_t));
+    decl_let_t *decl = arena_calloc(arena, 1, sizeof(decl_let_t));
     decl->base.tag = DECL_LET;
     decl->bound = bound;
     decl->value = value;
@@ -15,7 +15,7 @@ void decl_print(decl_t *decl)
 {
     if (decl->tag == DECL_LET) {
         decl_let_t *let = (decl_let_t *)decl;
-        printf("let %s", let->bound);
+        printf("let %s", sym_name(let->bound));
 
         if (let->scheme.type) {
             fputs(" : ", stdout);
@@ -33,14 +33,3 @@ void decl_println(decl_t *decl)
     decl_print(decl);
     puts("");
 }
-
-void decl_free(decl_t *decl)
-{
-    if (decl->tag == DECL_LET) {
-        decl_let_t *let = (decl_let_t *)decl;
-        expr_free(let->value);
-        free(let->bound);
-    }
-
-    free(decl);
-}
@@ -16,17 +16,15 @@ typedef struct {
 typedef struct {
     decl_t base;
     type_scheme_t scheme;
-    char *bound;
+    sym_t bound;
     expr_t *value;
     uint32_t id;
 } decl_let_t;
 
-decl_t *decl_let_new(char *bound, expr_t *value);
+decl_t *decl_let_new(arena_t *arena, sym_t bound, expr_t *value);
 
 void decl_print(decl_t *decl);
 
 void decl_println(decl_t *decl);
 
-void decl_free(decl_t *decl);
-
 #endif
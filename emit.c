@@ -0,0 +1,421 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "emit.h"
+#include "regalloc.h"
+
+typedef struct {
+    asm_t *as;
+    ir_func_t *func;
+    uint32_t n_slots;
+} emit_t;
+
+static sym_t emit_sym(const char *name)
+{
+    return sym_intern(name, strlen(name));
+}
+
+static int32_t emit_slot(uint32_t slot)
+{
+    // Spill slots sit right above the stack pointer, which does not move
+    // in the body
+    return 8 * slot;
+}
+
+// Register holding reg, loading it into scratch when it was spilled
+static asm_reg_t emit_use(emit_t *emit, ir_reg_t reg, asm_reg_t scratch)
+{
+    ir_loc_t *loc = &emit->func->locs[reg];
+    if (!loc->spilled)
+        return loc->reg;
+
+    asm_load(emit->as, scratch, ASM_RSP, emit_slot(loc->slot));
+    return scratch;
+}
+
+// A register, or a spill slot when spilled is set
+typedef struct {
+    bool spilled;
+    asm_reg_t reg;
+    int32_t disp;
+} emit_operand_t;
+
+static emit_operand_t emit_reg(asm_reg_t reg)
+{
+    return (emit_operand_t){ .reg = reg };
+}
+
+static emit_operand_t emit_loc(emit_t *emit, ir_reg_t reg)
+{
+    ir_loc_t *loc = &emit->func->locs[reg];
+    if (loc->spilled)
+        return (emit_operand_t){ .spilled = true, .disp = emit_slot(loc->slot) };
+    return emit_reg(loc->reg);
+}
+
+static void emit_copy(emit_t *emit, emit_operand_t dst, emit_operand_t src)
+{
+    asm_t *as = emit->as;
+
+    if (src.spilled && dst.spilled) {
+        asm_load(as, REGALLOC_SCRATCH_B, ASM_RSP, src.disp);
+        asm_store(as, ASM_RSP, dst.disp, REGALLOC_SCRATCH_B);
+    } else if (src.spilled) {
+        asm_load(as, dst.reg, ASM_RSP, src.disp);
+    } else if (dst.spilled) {
+        asm_store(as, ASM_RSP, dst.disp, src.reg);
+    } else if (dst.reg != src.reg) {
+        asm_mov(as, dst.reg, src.reg);
+    }
+}
+
+static bool emit_same(emit_operand_t a, emit_operand_t b)
+{
+    if (a.spilled != b.spilled)
+        return false;
+    return a.spilled ? a.disp == b.disp : a.reg == b.reg;
+}
+
+// n copies as if done at once, ordered so no source is overwritten before
+// it is read. Cycles are broken by parking one value in a scratch register.
+static void emit_parallel(emit_t *emit, emit_operand_t *dst, emit_operand_t *src, size_t n)
+{
+    size_t n_pending = 0;
+    emit_operand_t pending_dst[IR_MAX_ARGS];
+    emit_operand_t pending_src[IR_MAX_ARGS];
+
+    for (size_t i = 0; i < n; i++) {
+        if (!emit_same(dst[i], src[i])) {
+            pending_dst[n_pending] = dst[i];
+            pending_src[n_pending++] = src[i];
+        }
+    }
+
+    while (n_pending > 0) {
+        size_t ready = n_pending;
+        for (size_t i = 0; i < n_pending && ready == n_pending; i++) {
+            ready = i;
+            for (size_t j = 0; j < n_pending; j++) {
+                if (j != i && emit_same(pending_dst[i], pending_src[j])) {
+                    ready = n_pending;
+                    break;
+                }
+            }
+        }
+
+        if (ready == n_pending) {
+            emit_operand_t parked = pending_dst[0];
+            emit_copy(emit, emit_reg(REGALLOC_SCRATCH_B), parked);
+            for (size_t j = 0; j < n_pending; j++) {
+                if (emit_same(pending_src[j], parked))
+                    pending_src[j] = emit_reg(REGALLOC_SCRATCH_B);
+            }
+            ready = 0;
+        }
+
+        emit_copy(emit, pending_dst[ready], pending_src[ready]);
+        n_pending--;
+        pending_dst[ready] = pending_dst[n_pending];
+        pending_src[ready] = pending_src[n_pending];
+    }
+}
+
+static void emit_args(emit_t *emit, ir_inst_t *inst)
+{
+    emit_operand_t dst[IR_MAX_ARGS];
+    emit_operand_t src[IR_MAX_ARGS];
+    size_t n = 0;
+
+    for (uint32_t i = 0; i < inst->n_args; i++) {
+        if (inst->args[i] == IR_NONE)
+            continue;
+
+        dst[n] = emit_reg(regalloc_args[i]);
+        src[n++] = emit_loc(emit, inst->args[i]);
+    }
+
+    emit_parallel(emit, dst, src, n);
+}
+
+static void emit_params(emit_t *emit)
+{
+    emit_operand_t dst[IR_MAX_ARGS];
+    emit_operand_t src[IR_MAX_ARGS];
+    size_t n = 0;
+
+    // Parameters are defined up front, read them all before any is moved
+    for (size_t i = 0; i < emit->func->n_insts; i++) {
+        ir_inst_t *inst = &emit->func->insts[i];
+        if (inst->op != IR_PARAM)
+            break;
+
+        if (emit->func->locs[inst->dst].used) {
+            dst[n] = emit_loc(emit, inst->dst);
+            src[n++] = emit_reg(regalloc_args[inst->imm]);
+        }
+    }
+
+    emit_parallel(emit, dst, src, n);
+}
+
+// Register to compute reg into, written back by emit_def
+static asm_reg_t emit_dst(emit_t *emit, ir_reg_t reg)
+{
+    ir_loc_t *loc = &emit->func->locs[reg];
+    return loc->spilled ? REGALLOC_SCRATCH_B : loc->reg;
+}
+
+static void emit_def(emit_t *emit, ir_reg_t reg)
+{
+    ir_loc_t *loc = &emit->func->locs[reg];
+    if (loc->spilled)
+        asm_store(emit->as, ASM_RSP, emit_slot(loc->slot), REGALLOC_SCRATCH_B);
+}
+
+static void emit_result(emit_t *emit, ir_reg_t reg, asm_reg_t src)
+{
+    if (emit->func->locs[reg].used)
+        emit_copy(emit, emit_loc(emit, reg), emit_reg(src));
+}
+
+static void emit_prologue(emit_t *emit)
+{
+    asm_t *as = emit->as;
+    ir_func_t *func = emit->func;
+
+    if (func->global)
+        asm_global(as, func->name);
+    asm_label(as, func->name);
+
+    for (asm_reg_t reg = 0; reg <= ASM_R15; reg++) {
+        if (func->saved & 1u << reg)
+            asm_push(as, reg);
+    }
+
+    if (emit->n_slots)
+        asm_sub_imm(as, ASM_RSP, emit->n_slots * 8);
+}
+
+// Drops the frame, leaving the stack as it was on entry
+static void emit_teardown(emit_t *emit)
+{
+    asm_t *as = emit->as;
+    ir_func_t *func = emit->func;
+
+    if (emit->n_slots)
+        asm_add_imm(as, ASM_RSP, emit->n_slots * 8);
+
+    for (asm_reg_t reg = ASM_R15 + 1; reg-- > 0; ) {
+        if (func->saved & 1u << reg)
+            asm_pop(as, reg);
+    }
+}
+
+static void emit_epilogue(emit_t *emit)
+{
+    emit_teardown(emit);
+    asm_ret(emit->as);
+}
+
+// Bumps the nursery pointer inline, the refill routine keeps every
+// register but r11, where it returns the new pointer
+static void emit_alloc(emit_t *emit, ir_inst_t *inst)
+{
+    asm_t *as = emit->as;
+    ir_loc_t *loc = &emit->func->locs[inst->dst];
+    asm_reg_t dst = loc->spilled ? REGALLOC_SCRATCH_A : loc->reg;
+    sym_t heap_ptr = emit_sym("heap_ptr");
+    sym_t done = asm_local(as);
+
+    asm_load_sym(as, dst, heap_ptr);
+    asm_lea(as, REGALLOC_SCRATCH_B, dst, inst->imm);
+    asm_cmp_sym(as, REGALLOC_SCRATCH_B, emit_sym("heap_end"));
+    asm_jcc(as, ASM_CC_BE, done);
+    asm_mov_imm(as, REGALLOC_SCRATCH_B, inst->imm);
+    asm_call(as, emit_sym("heap_refill"));
+    asm_lea(as, dst, REGALLOC_SCRATCH_B, -inst->imm);
+    asm_label(as, done);
+    asm_store_sym(as, heap_ptr, REGALLOC_SCRATCH_B);
+
+    if (loc->spilled)
+        asm_store(as, ASM_RSP, emit_slot(loc->slot), dst);
+}
+
+static bool emit_pure(ir_inst_t *inst)
+{
+    return inst->op != IR_STORE && inst->op != IR_STORE_SYM
+        && inst->op != IR_CALL && inst->op != IR_CALL_SYM && inst->op != IR_CALL_C
+        && inst->op != IR_RET;
+}
+
+static void emit_inst(emit_t *emit, ir_inst_t *inst)
+{
+    asm_t *as = emit->as;
+
+    if (emit_pure(inst) && !emit->func->locs[inst->dst].used)
+        return;
+
+    switch (inst->op) {
+        case IR_PARAM:
+            // See emit_params
+            break;
+
+        case IR_IMM:
+            asm_mov_imm(as, emit_dst(emit, inst->dst), inst->imm);
+            emit_def(emit, inst->dst);
+            break;
+
+        case IR_ADDR:
+            asm_lea_sym(as, emit_dst(emit, inst->dst), inst->sym);
+            emit_def(emit, inst->dst);
+            break;
+
+        case IR_GOT:
+            asm_lea_got(as, emit_dst(emit, inst->dst), inst->sym);
+            emit_def(emit, inst->dst);
+            break;
+
+        case IR_LOAD: {
+            asm_reg_t base = emit_use(emit, inst->a, REGALLOC_SCRATCH_A);
+            asm_load(as, emit_dst(emit, inst->dst), base, inst->imm);
+            emit_def(emit, inst->dst);
+            break;
+        }
+
+        case IR_STORE: {
+            asm_reg_t base = emit_use(emit, inst->a, REGALLOC_SCRATCH_A);
+            asm_reg_t src = emit_use(emit, inst->b, REGALLOC_SCRATCH_B);
+            asm_store(as, base, inst->imm, src);
+            break;
+        }
+
+        case IR_ALLOC:
+            emit_alloc(emit, inst);
+            break;
+
+        case IR_FRAME:
+            // Frame objects sit above the spill slots
+            asm_lea(as, emit_dst(emit, inst->dst), ASM_RSP,
+                    emit_slot(emit->func->n_slots) + inst->imm);
+            emit_def(emit, inst->dst);
+            break;
+
+        case IR_LOAD_SYM:
+            asm_load_sym(as, emit_dst(emit, inst->dst), inst->sym);
+            emit_def(emit, inst->dst);
+            break;
+
+        case IR_STORE_SYM:
+            asm_store_sym(as, inst->sym, emit_use(emit, inst->a, REGALLOC_SCRATCH_A));
+            break;
+
+        case IR_CALL:
+            // Closures take themselves in rdi and their argument in rsi
+            emit_args(emit, inst);
+            if (inst->tail) {
+                emit_teardown(emit);
+                asm_jmp_mem(as, ASM_RDI, 0);
+                break;
+            }
+            asm_call_mem(as, ASM_RDI, 0);
+            emit_result(emit, inst->dst, ASM_RAX);
+            break;
+
+        case IR_CALL_SYM:
+            emit_args(emit, inst);
+            if (inst->tail) {
+                emit_teardown(emit);
+                asm_jmp(as, inst->sym);
+                break;
+            }
+            asm_call(as, inst->sym);
+            emit_result(emit, inst->dst, ASM_RAX);
+            break;
+
+        case IR_CALL_C:
+            // The argument moves only go through the other scratch register
+            emit_copy(emit, emit_reg(REGALLOC_SCRATCH_A), emit_loc(emit, inst->a));
+            emit_args(emit, inst);
+            if (inst->tail) {
+                emit_teardown(emit);
+                asm_jmp_mem(as, REGALLOC_SCRATCH_A, 0);
+                break;
+            }
+            asm_call_mem(as, REGALLOC_SCRATCH_A, 0);
+            emit_result(emit, inst->dst, ASM_RAX);
+            break;
+
+        case IR_RET:
+            if (inst->a != IR_NONE)
+                emit_copy(emit, emit_reg(ASM_RAX), emit_loc(emit, inst->a));
+            emit_epilogue(emit);
+            break;
+    }
+}
+
+void emit_func(asm_t *as, ir_func_t *func)
+{
+    emit_t emit = {
+        .as = as,
+        .func = func,
+        .n_slots = func->n_slots + func->frame_size / 8,
+    };
+
+    // Calls need the stack 16-byte aligned, it is 8 off on entry
+    uint32_t n_saved = __builtin_popcount(func->saved);
+    if (func->calls && !((n_saved + emit.n_slots) & 1))
+        emit.n_slots++;
+
+    emit_prologue(&emit);
+    emit_params(&emit);
+    for (size_t i = 0; i < func->n_insts; i++)
+        emit_inst(&emit, &func->insts[i]);
+}
+
+// heap_refill pushes every register, the collector finds the closures
+// they hold on the stack. r11 holding the size goes last.
+static const asm_reg_t emit_refill_saved[] = {
+    ASM_RAX, ASM_RCX, ASM_RDX, ASM_RBX, ASM_RBP, ASM_RSI, ASM_RDI,
+    ASM_R8, ASM_R9, ASM_R10, ASM_R12, ASM_R13, ASM_R14, ASM_R15,
+};
+
+#define EMIT_REFILL_SAVED (sizeof(emit_refill_saved) / sizeof(asm_reg_t))
+
+// heap_refill takes the size wanted in r11 and returns the new nursery
+// pointer past it, see gc_refill. The allocation site has the stack
+// aligned for a call.
+void emit_runtime(asm_t *as, sym_t globals, sym_t globals_end)
+{
+    sym_t heap_ptr = emit_sym("heap_ptr");
+    sym_t gc_refill = emit_sym("gc_refill");
+
+    asm_extern(as, gc_refill);
+    asm_label(as, emit_sym("heap_refill"));
+
+    for (size_t i = 0; i < EMIT_REFILL_SAVED; i++)
+        asm_push(as, emit_refill_saved[i]);
+
+    // Odd number of pushes keeps gc_refill's stack aligned
+    asm_push(as, REGALLOC_SCRATCH_B);
+    asm_mov(as, ASM_RDI, REGALLOC_SCRATCH_B);
+    asm_lea_sym(as, ASM_RSI, heap_ptr);
+    asm_mov(as, ASM_RDX, ASM_RSP);
+    asm_lea_sym(as, ASM_RCX, globals);
+    asm_lea_sym(as, ASM_R8, globals_end);
+    asm_call(as, gc_refill);
+    asm_mov(as, REGALLOC_SCRATCH_B, ASM_RAX);
+    asm_add_imm(as, ASM_RSP, 8);
+
+    for (size_t i = EMIT_REFILL_SAVED; i-- > 0; )
+        asm_pop(as, emit_refill_saved[i]);
+    asm_ret(as);
+
+    // gc_refill sets heap_end right after heap_ptr
+    asm_section(as, ASM_BSS);
+    asm_align(as, 8);
+    asm_label(as, heap_ptr);
+    asm_skip(as, 8);
+    asm_label(as, emit_sym("heap_end"));
+    asm_skip(as, 8);
+    asm_section(as, ASM_TEXT);
+}
@@ -0,0 +1,14 @@
+#ifndef EMIT_H
+#define EMIT_H
+
+#include "asm.h"
+#include "ir.h"
+
+// Emit an allocated function, see regalloc_func
+void emit_func(asm_t *as, ir_func_t *func);
+
+// Emit the nursery the generated code allocates from. The globals of the
+// unit, which the collector scans, are the words in [globals, globals_end).
+void emit_runtime(asm_t *as, sym_t globals, sym_t globals_end);
+
+#endif
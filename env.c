@@ -5,69 +5,256 @@
 
 #include "env.h"
 
-env_t *env_append(env_t *tail, const char *name, intptr_t value)
+#define ENV_MASK ((1u << ENV_BITS) - 1)
+#define ENV_INDEX(hash, shift) (1u << (((hash) >> (shift)) & ENV_MASK))
+
+typedef struct {
+    env_t *node;
+    sym_t name;
+    intptr_t value;
+} env_slot_t;
+
+struct env {
+    uint32_t bitmap;
+    uint32_t length;
+    env_slot_t slots[];
+};
+
+static uint32_t env_hash(sym_t name)
 {
-    env_t *head = malloc(sizeof(env_t));
-    head->name = name;
-    head->next = tail;
-    head->value = value;
-    return head;
+    // Bijective mix, distinct symbols never share a full hash
+    uint32_t hash = name;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
 }
 
-env_t *env_update(env_t *tail, const char *name, intptr_t value)
+static size_t env_slots(env_t *node)
 {
-    for (env_t *env = tail; env; env = env->next) {
-        if (!strcmp(name, env->name)) {
-            env->value = value;
-            return tail;
-        }
+    return __builtin_popcount(node->bitmap);
+}
+
+static size_t env_slot(env_t *node, uint32_t bit)
+{
+    return __builtin_popcount(node->bitmap & (bit - 1));
+}
+
+static env_t *env_node_new(arena_t *arena, size_t n_slots)
+{
+    return arena_alloc(arena, sizeof(env_t) + n_slots * sizeof(env_slot_t));
+}
+
+static env_t *env_node_copy(arena_t *arena, env_t *node)
+{
+    size_t size = sizeof(env_t) + env_slots(node) * sizeof(env_slot_t);
+    env_t *copy = arena_alloc(arena, size);
+    memcpy(copy, node, size);
+    return copy;
+}
+
+static env_t *env_pair(arena_t *arena, unsigned shift,
+                       env_slot_t *a, uint32_t a_hash,
+                       env_slot_t *b, uint32_t b_hash)
+{
+    uint32_t a_bit = ENV_INDEX(a_hash, shift);
+    uint32_t b_bit = ENV_INDEX(b_hash, shift);
+
+    if (a_bit == b_bit) {
+        env_t *node = env_node_new(arena, 1);
+        node->bitmap = a_bit;
+        node->length = 2;
+        node->slots[0].node = env_pair(arena, shift + ENV_BITS, a, a_hash, b, b_hash);
+        return node;
     }
-    return env_append(tail, name, value);
+
+    env_t *node = env_node_new(arena, 2);
+    node->bitmap = a_bit | b_bit;
+    node->length = 2;
+    node->slots[a_bit < b_bit ? 0 : 1] = *a;
+    node->slots[a_bit < b_bit ? 1 : 0] = *b;
+    return node;
 }
 
-env_t *env_remove(env_t *tail, const char *name)
+static env_t *env_insert(arena_t *arena, env_t *node, unsigned shift,
+                         uint32_t hash, sym_t name, intptr_t value)
 {
-    for (env_t *env = tail, *prev = NULL; env; env = env->next) {
-        if (!strcmp(name, env->name)) {
-            if (prev == NULL) tail = env->next;
-            else prev->next = env->next;
-            free(env);
-            break;
+    env_slot_t leaf = { NULL, name, value };
+    uint32_t bit = ENV_INDEX(hash, shift);
+
+    if (node == NULL) {
+        node = env_node_new(arena, 1);
+        node->bitmap = bit;
+        node->length = 1;
+        node->slots[0] = leaf;
+        return node;
+    }
+
+    size_t n = env_slots(node);
+    size_t i = env_slot(node, bit);
+
+    if (!(node->bitmap & bit)) {
+        env_t *copy = env_node_new(arena, n + 1);
+        copy->bitmap = node->bitmap | bit;
+        copy->length = node->length + 1;
+        memcpy(copy->slots, node->slots, i * sizeof(env_slot_t));
+        copy->slots[i] = leaf;
+        memcpy(copy->slots + i + 1, node->slots + i, (n - i) * sizeof(env_slot_t));
+        return copy;
+    }
+
+    env_t *copy = env_node_copy(arena, node);
+    env_slot_t *slot = &copy->slots[i];
+
+    if (slot->node != NULL) {
+        env_t *child = env_insert(arena, slot->node, shift + ENV_BITS, hash, name, value);
+        copy->length += child->length - slot->node->length;
+        slot->node = child;
+    } else if (slot->name == name) {
+        slot->value = value;
+    } else {
+        env_slot_t old = *slot;
+        slot->node = env_pair(arena, shift + ENV_BITS,
+                              &old, env_hash(old.name),
+                              &leaf, hash);
+        copy->length++;
+    }
+    return copy;
+}
+
+static env_t *env_delete(arena_t *arena, env_t *node, unsigned shift,
+                         uint32_t hash, sym_t name)
+{
+    uint32_t bit = ENV_INDEX(hash, shift);
+    if (node == NULL || !(node->bitmap & bit))
+        return node;
+
+    size_t n = env_slots(node);
+    size_t i = env_slot(node, bit);
+    env_slot_t *slot = &node->slots[i];
+
+    if (slot->node != NULL) {
+        env_t *child = env_delete(arena, slot->node, shift + ENV_BITS, hash, name);
+        if (child == slot->node)
+            return node;
+
+        if (child != NULL) {
+            env_t *copy = env_node_copy(arena, node);
+            copy->length--;
+
+            // Pull a lone leaf back up into this node
+            if (child->length == 1 && child->slots[0].node == NULL)
+                copy->slots[i] = child->slots[0];
+            else
+                copy->slots[i].node = child;
+            return copy;
         }
-        prev = env;
+    } else if (slot->name != name) {
+        return node;
     }
-    return tail;
+
+    if (n == 1)
+        return NULL;
+
+    env_t *copy = env_node_new(arena, n - 1);
+    copy->bitmap = node->bitmap & ~bit;
+    copy->length = node->length - 1;
+    memcpy(copy->slots, node->slots, i * sizeof(env_slot_t));
+    memcpy(copy->slots + i, node->slots + i + 1, (n - i - 1) * sizeof(env_slot_t));
+    return copy;
 }
 
-ssize_t env_find(env_t *env, const char *name, intptr_t *value)
+env_t *env_append(arena_t *arena, env_t *tail, sym_t name, intptr_t value)
 {
-    size_t i = 0;
-    for ( ; env; env = env->next) {
-        if (!strcmp(name, env->name)) {
+    return env_insert(arena, tail, 0, env_hash(name), name, value);
+}
+
+env_t *env_update(arena_t *arena, env_t *tail, sym_t name, intptr_t value)
+{
+    // A binding replaces any previous one, so this is the same as an append
+    return env_append(arena, tail, name, value);
+}
+
+env_t *env_remove(arena_t *arena, env_t *tail, sym_t name)
+{
+    return env_delete(arena, tail, 0, env_hash(name), name);
+}
+
+bool env_find(env_t *env, sym_t name, intptr_t *value)
+{
+    uint32_t hash = env_hash(name);
+
+    for (unsigned shift = 0; env; shift += ENV_BITS) {
+        uint32_t bit = ENV_INDEX(hash, shift);
+        if (!(env->bitmap & bit))
+            return false;
+
+        env_slot_t *slot = &env->slots[env_slot(env, bit)];
+        if (slot->node == NULL) {
+            if (slot->name != name)
+                return false;
+
             if (value)
-                *value = env->value;
-            return i;
+                *value = slot->value;
+            return true;
         }
-        i++;
+        env = slot->node;
     }
-    return -1;
+    return false;
 }
 
 size_t env_length(env_t *env)
 {
-    size_t i = 0;
-    for ( ; env; env = env->next)
-        i++;
-    return i;
+    return env ? env->length : 0;
+}
+
+void env_iter_init(env_iter_t *iter, env_t *env)
+{
+    iter->depth = env ? 1 : 0;
+    iter->nodes[0] = env;
+    iter->index[0] = 0;
+}
+
+bool env_iter_next(env_iter_t *iter, sym_t *name, intptr_t *value)
+{
+    while (iter->depth > 0) {
+        env_t *node = iter->nodes[iter->depth - 1];
+        uint32_t i = iter->index[iter->depth - 1]++;
+
+        if (i >= env_slots(node)) {
+            iter->depth--;
+            continue;
+        }
+
+        env_slot_t *slot = &node->slots[i];
+        if (slot->node != NULL) {
+            iter->nodes[iter->depth] = slot->node;
+            iter->index[iter->depth] = 0;
+            iter->depth++;
+            continue;
+        }
+
+        *name = slot->name;
+        *value = slot->value;
+        return true;
+    }
+    return false;
 }
 
 void env_print(env_t *env)
 {
-    for ( ; env; env = env->next) {
-        printf("%s: %ld%s",
-               env->name,
-               env->value,
-               env->next ? ", " : "");
+    env_iter_t iter;
+    env_iter_init(&iter, env);
+
+    sym_t name;
+    intptr_t value;
+    for (size_t i = 0; env_iter_next(&iter, &name, &value); i++) {
+        printf("%s%s: %ld",
+               i ? ", " : "",
+               sym_name(name),
+               value);
     }
 }
 
@@ -79,10 +266,8 @@ void env_println(env_t *env)
 
 env_t *env_clear(env_t *head, env_t *until)
 {
-    while (head != until) {
-        env_t *next = head->next;
-        free(head);
-        head = next;
-    }
-    return head;
+    // Older versions are untouched by updates, and nodes are released
+    // together with the arena they live in
+    (void)head;
+    return until;
 }
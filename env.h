@@ -1,25 +1,41 @@
 #ifndef ENV_H
 #define ENV_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
 
-typedef struct env {
-    const char *name;
-    intptr_t value;
-    struct env *next;
-} env_t;
+#include "arena.h"
+#include "sym.h"
 
-env_t *env_append(env_t *tail, const char *name, intptr_t value);
+#define ENV_BITS 5
+#define ENV_DEPTH ((32 + ENV_BITS - 1) / ENV_BITS)
 
-env_t *env_update(env_t *tail, const char *name, intptr_t value);
+// Persistent hash array mapped trie keyed by symbol id.
+// NULL is the empty env, updates return a new version and never touch
+// the old one, so scopes are popped by going back to a previous version.
+typedef struct env env_t;
 
-env_t *env_remove(env_t *tail, const char *name);
+typedef struct {
+    size_t depth;
+    env_t *nodes[ENV_DEPTH];
+    uint32_t index[ENV_DEPTH];
+} env_iter_t;
 
-ssize_t env_find(env_t *env, const char *name, intptr_t *value);
+env_t *env_append(arena_t *arena, env_t *tail, sym_t name, intptr_t value);
+
+env_t *env_update(arena_t *arena, env_t *tail, sym_t name, intptr_t value);
+
+env_t *env_remove(arena_t *arena, env_t *tail, sym_t name);
+
+bool env_find(env_t *env, sym_t name, intptr_t *value);
 
 size_t env_length(env_t *env);
 
+void env_iter_init(env_iter_t *iter, env_t *env);
+
+bool env_iter_next(env_iter_t *iter, sym_t *name, intptr_t *value);
+
 void env_print(env_t *env);
 
 void env_println(env_t *env);
@@ -7,61 +7,61 @@
 #include "env.h"
 #include "type.h"
 
-expr_t *expr_lit_new_unit(void)
+expr_t *expr_lit_new_unit(arena_t *arena)
 {
-    expr_lit_t *expr = calloc(1, sizeof(expr_lit_t));
+    expr_lit_t *expr = arena_calloc(arena, 1, sizeof(expr_lit_t));
     expr->base.tag = EXPR_LIT;
     expr->kind = LIT_UNIT;
     return (expr_t *)expr;
 }
 
-expr_t *expr_lit_new_int(int64_t intv)
+expr_t *expr_lit_new_int(arena_t *arena, int64_t intv)
 {
-    expr_lit_t *expr = calloc(1, sizeof(expr_lit_t));
+    expr_lit_t *expr = arena_calloc(arena, 1, sizeof(expr_lit_t));
     expr->base.tag = EXPR_LIT;
     expr->kind = LIT_INT;
     expr->intv = intv;
     return (expr_t *)expr;
 }
 
-expr_t *expr_lit_new_str(char *strv)
+expr_t *expr_lit_new_str(arena_t *arena, char *strv)
 {
-    expr_lit_t *expr = calloc(1, sizeof(expr_lit_t));
+    expr_lit_t *expr = arena_calloc(arena, 1, sizeof(expr_lit_t));
     expr->base.tag = EXPR_LIT;
     expr->kind = LIT_STR;
     expr->strv = strv;
     return (expr_t *)expr;
 }
 
-expr_t *expr_var_new(char *name)
+expr_t *expr_var_new(arena_t *arena, sym_t name)
 {
-    expr_var_t *expr = calloc(1, sizeof(expr_var_t));
+    expr_var_t *expr = arena_calloc(arena, 1, sizeof(expr_var_t));
     expr->base.tag = EXPR_VAR;
     expr->name = name;
     return (expr_t *)expr;
 }
 
-expr_t *expr_lambda_new(char *bound, expr_t *body)
+expr_t *expr_lambda_new(arena_t *arena, sym_t bound, expr_t *body)
 {
-    expr_lambda_t *expr = calloc(1, sizeof(expr_lambda_t));
+    expr_lambda_t *expr = arena_calloc(arena, 1, sizeof(expr_lambda_t));
     expr->base.tag = EXPR_LAMBDA;
     expr->bound = bound;
     expr->body = body;
     return (expr_t *)expr;
 }
 
-expr_t *expr_apply_new(expr_t *fun, expr_t *arg)
+expr_t *expr_apply_new(arena_t *arena, expr_t *fun, expr_t *arg)
 {
-    expr_apply_t *expr = calloc(1, sizeof(expr_apply_t));
+    expr_apply_t *expr = arena_calloc(arena, 1, sizeof(expr_apply_t));
     expr->base.tag = EXPR_APPLY;
     expr->fun = fun;
     expr->arg = arg;
     return (expr_t *)expr;
 }
 
-expr_t *expr_let_new(char *bound, expr_t *value, expr_t *body)
+expr_t *expr_let_new(arena_t *arena, sym_t bound, expr_t *value, expr_t *body)
 {
-    expr_let_t *expr = calloc(1, sizeof(expr_let_t));
+    expr_let_t *expr = arena_calloc(arena, 1, sizeof(expr_let_t));
     expr->base.tag = EXPR_LET;
     expr->bound = bound;
     expr->value = value;
@@ -71,13 +71,64 @@ expr_t *expr_let_new(char *bound, expr_t *value, expr_t *body)
 
 expr_t *expr_annotate(expr_t *expr, type_t *type)
 {
-    if (expr->type != NULL)
-        type_free(expr->type);
-
     expr->type = type;
     return expr;
 }
 
+static type_t *expr_copy_type(arena_t *arena, type_t *type, type_scheme_t *scheme, type_t **types)
+{
+    if (type && scheme)
+        return type_scheme_apply(arena, scheme, types, type);
+    return type;
+}
+
+expr_t *expr_copy(arena_t *arena, expr_t *expr, type_scheme_t *scheme, type_t **types)
+{
+    expr_t *copy = NULL;
+
+    switch (expr->tag) {
+        case EXPR_LIT: {
+            expr_lit_t *lit = (expr_lit_t *)expr;
+            if (lit->kind == LIT_STR)
+                copy = expr_lit_new_str(arena, lit->strv);
+            else if (lit->kind == LIT_INT)
+                copy = expr_lit_new_int(arena, lit->intv);
+            else
+                copy = expr_lit_new_unit(arena);
+            break;
+        }
+
+        case EXPR_VAR:
+            copy = expr_var_new(arena, ((expr_var_t *)expr)->name);
+            break;
+
+        case EXPR_LAMBDA: {
+            expr_lambda_t *lam = (expr_lambda_t *)expr;
+            copy = expr_lambda_new(arena, lam->bound, expr_copy(arena, lam->body, scheme, types));
+            break;
+        }
+
+        case EXPR_APPLY: {
+            expr_apply_t *app = (expr_apply_t *)expr;
+            copy = expr_apply_new(arena, expr_copy(arena, app->fun, scheme, types),
+                                  expr_copy(arena, app->arg, scheme, types));
+            break;
+        }
+
+        case EXPR_LET: {
+            expr_let_t *let = (expr_let_t *)expr;
+            copy = expr_let_new(arena, let->bound, expr_copy(arena, let->value, scheme, types),
+                                expr_copy(arena, let->body, scheme, types));
+
+            type_t *type = expr_copy_type(arena, let->scheme.type, scheme, types);
+            type_scheme_init(arena, &((expr_let_t *)copy)->scheme, type, let->scheme.n_vars, let->scheme.vars);
+            break;
+        }
+    }
+
+    return expr_annotate(copy, expr_copy_type(arena, expr->type, scheme, types));
+}
+
 void expr_print(expr_t *expr)
 {
     switch (expr->tag) {
@@ -101,16 +152,16 @@ void expr_print(expr_t *expr)
 
         case EXPR_VAR: {
             expr_var_t *var = (expr_var_t *)expr;
-            fputs(var->name, stdout);
+            fputs(sym_name(var->name), stdout);
             break;
         }
 
         case EXPR_LAMBDA: {
             expr_lambda_t *lam = (expr_lambda_t *)expr;
-            fprintf(stdout, "\\%s", lam->bound);
+            fprintf(stdout, "\\%s", sym_name(lam->bound));
 
             if (expr->type && expr->type->tag == TYPE_CON
-                && !strcmp(((type_con_t *)expr->type)->name, "->")) {
+                && ((type_con_t *)expr->type)->name == SYM_ARROW) {
                 fputs(" : ", stdout);
                 type_print(((type_con_t *)expr->type)->args[0]);
             }
@@ -138,7 +189,7 @@ void expr_print(expr_t *expr)
 
         case EXPR_LET: {
             expr_let_t *let = (expr_let_t *)expr;
-            printf("let %s", let->bound);
+            printf("let %s", sym_name(let->bound));
 
             if (let->value->type && let->scheme.type) {
                 fputs(" : ", stdout);
@@ -160,46 +211,3 @@ void expr_println(expr_t *expr)
     expr_print(expr);
     puts("");
 }
-
-void expr_free(expr_t *expr)
-{
-    switch (expr->tag) {
-        case EXPR_LIT: {
-            expr_lit_t *lit = (expr_lit_t *)expr;
-            if (lit->kind == LIT_STR)
-                free(lit->strv);
-            break;
-        }
-
-        case EXPR_VAR: {
-            expr_var_t *var = (expr_var_t *)expr;
-            free(var->name);
-            break;
-        }
-
-        case EXPR_LAMBDA: {
-            expr_lambda_t *lam = (expr_lambda_t *)expr;
-            free(lam->bound);
-            expr_free(lam->body);
-            free(lam->id);
-            env_clear(lam->freevars, NULL);
-            break;
-        }
-
-        case EXPR_APPLY: {
-            expr_apply_t *app = (expr_apply_t *)expr;
-            expr_free(app->fun);
-            expr_free(app->arg);
-            break;
-        }
-
-        case EXPR_LET: {
-            expr_let_t *let = (expr_let_t *)expr;
-            free(let->bound);
-            expr_free(let->value);
-            expr_free(let->body);
-            break;
-        }
-    }
-    free(expr);
-}
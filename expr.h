@@ -29,55 +29,81 @@ typedef struct {
         int64_t intv;
         char *strv;
     };
+    // Label of a string once compiled
+    sym_t id;
 } expr_lit_t;
 
 typedef struct {
     expr_t base;
-    char *name;
+    sym_t name;
 } expr_var_t;
 
 typedef struct {
     expr_t base;
-    char *bound;
+    sym_t bound;
     expr_t *body;
-    char *id;
-    struct env *freevars;
+    sym_t id;
+    // Names the closure captures, field i + 1 holds captures[i]. Set by
+    // closure conversion, before the code is compiled.
+    sym_t *captures;
+    uint32_t n_captures;
+    // Free variables bound to constants, which the code rebuilds instead
+    // of capturing
+    struct env *consts;
+    // Parameters taken at once by the entry, for the lambdas nested in
+    // this one
+    uint32_t arity;
+    sym_t entry;
+    // Captures at the end of the closure that never point to another
+    // closure, the collector skips them
+    uint32_t scalars;
+    // Parameters of the entry that may outlive a call to it, a bit each
+    uint32_t escapes;
+    // The closure never outlives the function building it, so it goes in
+    // that function's frame
+    bool stack;
 } expr_lambda_t;
 
 typedef struct {
     expr_t base;
     expr_t *fun;
     expr_t *arg;
+    // The lambda fun is statically bound to, if any
+    expr_lambda_t *known;
+    // Label of the static closure it evaluates to, if built at compile time
+    sym_t id;
 } expr_apply_t;
 
 typedef struct {
     expr_t base;
-    char *bound;
+    sym_t bound;
     expr_t *value;
     expr_t *body;
     type_scheme_t scheme;
 } expr_let_t;
 
-expr_t *expr_lit_new_unit(void);
+expr_t *expr_lit_new_unit(arena_t *arena);
 
-expr_t *expr_lit_new_int(int64_t intv);
+expr_t *expr_lit_new_int(arena_t *arena, int64_t intv);
 
-expr_t *expr_lit_new_str(char *strv);
+expr_t *expr_lit_new_str(arena_t *arena, char *strv);
 
-expr_t *expr_var_new(char *name);
+expr_t *expr_var_new(arena_t *arena, sym_t name);
 
-expr_t *expr_lambda_new(char *bound, expr_t *body);
+expr_t *expr_lambda_new(arena_t *arena, sym_t bound, expr_t *body);
 
-expr_t *expr_apply_new(expr_t *fun, expr_t *arg);
+expr_t *expr_apply_new(arena_t *arena, expr_t *fun, expr_t *arg);
 
-expr_t *expr_let_new(char *bound, expr_t *value, expr_t *body);
+expr_t *expr_let_new(arena_t *arena, sym_t bound, expr_t *value, expr_t *body);
 
 expr_t *expr_annotate(expr_t *expr, type_t *type);
 
+// A copy of the tree of expr, with the quantified vars of scheme replaced
+// by types in its types when scheme is set
+expr_t *expr_copy(arena_t *arena, expr_t *expr, type_scheme_t *scheme, type_t **types);
+
 void expr_print(expr_t *expr);
 
 void expr_println(expr_t *expr);
 
-void expr_free(expr_t *expr);
-
 #endif
@@ -0,0 +1,323 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "gc.h"
+
+// Closures are bump-allocated in blocks and never span two
+#define GC_BLOCK (32 << 10)
+#define GC_WORDS (GC_BLOCK / 8)
+// Address space reserved for the heap, blocks are backed as they are used
+#define GC_MAX_BLOCKS (1u << 18)
+// Blocks made writable at a time
+#define GC_GROW 64u
+// Blocks allocated between minor collections
+#define GC_NURSERY 64
+// Old blocks that trigger the first major collection
+#define GC_OLD_MIN 256
+
+#define GC_NONE UINT32_MAX
+
+typedef enum {
+    GC_FREE,
+    GC_YOUNG,
+    GC_OLD,
+} gc_state_t;
+
+typedef struct {
+    gc_state_t state;
+    // Used blocks in allocation order, the free list goes through next
+    uint32_t prev;
+    uint32_t next;
+    // Bytes taken by closures
+    uint32_t fill;
+    // Whether starts has been filled in up to fill
+    bool walked;
+    uint64_t starts[GC_WORDS / 64];
+    uint64_t marks[GC_WORDS / 64];
+} gc_block_t;
+
+typedef struct {
+    char *base;
+    gc_block_t *blocks;
+    uint32_t n_blocks;
+    uint32_t n_mapped;
+    uint32_t free;
+    uint32_t oldest;
+    uint32_t newest;
+    uint32_t current;
+    uint32_t n_young;
+    uint32_t n_old;
+    uint32_t max_old;
+    char *stack_top;
+} gc_heap_t;
+
+// Each thread runs its own program, see jit_run
+static __thread gc_heap_t gc_heap;
+
+static void gc_fail(const char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    abort();
+}
+
+static void gc_init(gc_heap_t *h)
+{
+    h->base = mmap(NULL, (size_t)GC_MAX_BLOCKS * GC_BLOCK, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (h->base == MAP_FAILED)
+        gc_fail("Failed to reserve the heap");
+
+    h->free = h->oldest = h->newest = h->current = GC_NONE;
+    h->max_old = GC_OLD_MIN;
+
+    pthread_attr_t attr;
+    void *stack;
+    size_t size;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0
+        || pthread_attr_getstack(&attr, &stack, &size) != 0)
+        gc_fail("Failed to find the stack");
+    pthread_attr_destroy(&attr);
+    h->stack_top = (char *)stack + size;
+}
+
+static char *gc_block_addr(gc_heap_t *h, uint32_t b)
+{
+    return h->base + (size_t)b * GC_BLOCK;
+}
+
+static uint32_t gc_block_new(gc_heap_t *h)
+{
+    uint32_t b = h->free;
+    if (b != GC_NONE) {
+        h->free = h->blocks[b].next;
+    } else {
+        if (h->n_blocks == GC_MAX_BLOCKS)
+            gc_fail("Out of heap");
+
+        if (h->n_blocks == h->n_mapped) {
+            if (mprotect(gc_block_addr(h, h->n_mapped), GC_GROW * GC_BLOCK,
+                         PROT_READ | PROT_WRITE) < 0)
+                gc_fail("Failed to grow the heap");
+
+            h->n_mapped += GC_GROW;
+            h->blocks = realloc(h->blocks, h->n_mapped * sizeof(gc_block_t));
+        }
+        b = h->n_blocks++;
+    }
+
+    gc_block_t *block = &h->blocks[b];
+    block->state = GC_YOUNG;
+    block->fill = 0;
+    block->walked = false;
+
+    block->prev = h->newest;
+    block->next = GC_NONE;
+    if (h->newest != GC_NONE)
+        h->blocks[h->newest].next = b;
+    else
+        h->oldest = b;
+    h->newest = b;
+
+    h->n_young++;
+    return b;
+}
+
+static void gc_block_free(gc_heap_t *h, uint32_t b, bool release)
+{
+    gc_block_t *block = &h->blocks[b];
+
+    if (block->prev != GC_NONE)
+        h->blocks[block->prev].next = block->next;
+    else
+        h->oldest = block->next;
+
+    if (block->next != GC_NONE)
+        h->blocks[block->next].prev = block->prev;
+    else
+        h->newest = block->prev;
+
+    block->state = GC_FREE;
+    block->next = h->free;
+    h->free = b;
+
+    if (release)
+        madvise(gc_block_addr(h, b), GC_BLOCK, MADV_DONTNEED);
+}
+
+// The size of a closure is stored right before its code, unaligned, with
+// the number of trailing fields that hold no pointers above it
+static uint64_t gc_header(void **closure)
+{
+    uint64_t header;
+    memcpy(&header, (char *)closure[0] - sizeof(uint64_t), sizeof(uint64_t));
+    return header;
+}
+
+static size_t gc_size(void **closure)
+{
+    return (uint32_t)gc_header(closure);
+}
+
+static void gc_walk(gc_block_t *block, char *start)
+{
+    memset(block->starts, 0, sizeof(block->starts));
+
+    for (uint32_t offset = 0; offset < block->fill; ) {
+        uint32_t word = offset / 8;
+        block->starts[word / 64] |= 1ull << (word % 64);
+
+        size_t size = gc_size((void **)(start + offset));
+        if (size == 0 || size % 8 != 0 || size > block->fill - offset)
+            gc_fail("Corrupt heap");
+        offset += size;
+    }
+
+    block->walked = true;
+}
+
+// Any word could be a pointer, only ones to the start of a closure in a
+// block being collected mark it
+static void gc_mark(gc_heap_t *h, void *word, bool major)
+{
+    uintptr_t offset = (uintptr_t)word - (uintptr_t)h->base;
+    if (offset >= (uintptr_t)h->n_blocks * GC_BLOCK || offset % 8 != 0)
+        return;
+
+    gc_block_t *block = &h->blocks[offset / GC_BLOCK];
+    if (block->state != GC_YOUNG && !(major && block->state == GC_OLD))
+        return;
+
+    uint32_t index = offset % GC_BLOCK / 8;
+    block->marks[index / 64] |= block->starts[index / 64] & 1ull << (index % 64);
+}
+
+// The stack is read whole, whatever the frames in it hold
+__attribute__((no_sanitize("address")))
+static void gc_scan(gc_heap_t *h, void **from, void **to, bool major)
+{
+    for (void **word = from; word < to; word++)
+        gc_mark(h, *word, major);
+}
+
+static bool gc_marked(gc_block_t *block)
+{
+    uint64_t any = 0;
+    for (size_t i = 0; i < GC_WORDS / 64; i++)
+        any |= block->marks[i];
+    return any != 0;
+}
+
+// Young blocks are newer than all old ones, a minor collection stops at
+// the first old block from the newest end
+static bool gc_collected(gc_block_t *block, bool major)
+{
+    return major || block->state == GC_YOUNG;
+}
+
+static void gc_collect(gc_heap_t *h, bool major, void **sp, void **globals, void **globals_end)
+{
+    for (uint32_t b = h->newest; b != GC_NONE; b = h->blocks[b].prev) {
+        gc_block_t *block = &h->blocks[b];
+        if (!gc_collected(block, major))
+            break;
+
+        if (!block->walked)
+            gc_walk(block, gc_block_addr(h, b));
+        memset(block->marks, 0, sizeof(block->marks));
+    }
+
+    gc_scan(h, sp, (void **)h->stack_top, major);
+    gc_scan(h, globals, globals_end, major);
+
+    // Closures are immutable and only point to older ones, so going from
+    // the newest down reaches every closure before its fields are needed
+    for (uint32_t b = h->newest; b != GC_NONE; b = h->blocks[b].prev) {
+        gc_block_t *block = &h->blocks[b];
+        if (!gc_collected(block, major))
+            break;
+
+        char *start = gc_block_addr(h, b);
+        for (uint32_t i = GC_WORDS / 64; i-- > 0; ) {
+            uint64_t left = block->marks[i];
+            while (left) {
+                uint32_t bit = 63 - __builtin_clzll(left);
+                void **closure = (void **)(start + (i * 64 + bit) * 8);
+
+                uint64_t header = gc_header(closure);
+                size_t n_words = (uint32_t)header / 8 - (header >> 32);
+                for (size_t j = 1; j < n_words; j++)
+                    gc_mark(h, closure[j], major);
+
+                // Fields may have marked lower closures in the same word
+                left = block->marks[i] & ((1ull << bit) - 1);
+            }
+        }
+    }
+
+    uint32_t n_old = major ? 0 : h->n_old;
+    for (uint32_t b = h->newest; b != GC_NONE; ) {
+        gc_block_t *block = &h->blocks[b];
+        uint32_t prev = block->prev;
+        if (!gc_collected(block, major))
+            break;
+
+        if (!gc_marked(block)) {
+            gc_block_free(h, b, major);
+        } else {
+            block->state = GC_OLD;
+            n_old++;
+        }
+        b = prev;
+    }
+
+    h->n_young = 0;
+    h->n_old = n_old;
+}
+
+char *gc_refill(size_t size, char **heap, void **sp, void **globals, void **globals_end)
+{
+    gc_heap_t *h = &gc_heap;
+    if (h->base == NULL)
+        gc_init(h);
+
+    if (size > GC_BLOCK)
+        gc_fail("Closure too large for a heap block");
+
+    if (h->current != GC_NONE) {
+        h->blocks[h->current].fill = heap[0] - gc_block_addr(h, h->current);
+        h->current = GC_NONE;
+    }
+
+    if (h->n_young >= GC_NURSERY) {
+        gc_collect(h, false, sp, globals, globals_end);
+
+        // Survivors of major collections set how far the old blocks can
+        // grow before the next one
+        if (h->n_old > h->max_old) {
+            gc_collect(h, true, sp, globals, globals_end);
+            h->max_old = h->n_old * 2 > GC_OLD_MIN ? h->n_old * 2 : GC_OLD_MIN;
+        }
+    }
+
+    h->current = gc_block_new(h);
+    char *start = gc_block_addr(h, h->current);
+    heap[1] = start + GC_BLOCK;
+    return start + size;
+}
+
+void gc_reset(void)
+{
+    gc_heap_t *h = &gc_heap;
+    if (h->base == NULL)
+        return;
+
+    munmap(h->base, (size_t)GC_MAX_BLOCKS * GC_BLOCK);
+    free(h->blocks);
+    memset(h, 0, sizeof(gc_heap_t));
+}
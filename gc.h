@@ -0,0 +1,18 @@
+#ifndef GC_H
+#define GC_H
+
+#include <stddef.h>
+
+// Runtime of the generated code, linked into nmlc for --run and into the
+// executables it builds.
+
+// Called by heap_refill once the nursery block is used up. heap points to
+// the unit's heap_ptr and heap_end, sp to the registers it pushed, and the
+// globals of the unit are the words in [globals, globals_end). Returns the
+// new heap_ptr past size bytes, and stores the new heap_end.
+char *gc_refill(size_t size, char **heap, void **sp, void **globals, void **globals_end);
+
+// Drops the heap of this thread, once the code that used it is gone
+void gc_reset(void);
+
+#endif
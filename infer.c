@@ -11,89 +11,148 @@
 #include "expr.h"
 #include "type.h"
 
+static void infer_var_add(infer_t *infer, type_var_t *var)
+{
+    if (infer->n_vars == infer->cap_vars) {
+        infer->cap_vars = infer->cap_vars ? infer->cap_vars * 2 : 64;
+        infer->vars = realloc(infer->vars, infer->cap_vars * sizeof(infer_var_t));
+    }
+
+    infer_var_t *entry = &infer->vars[infer->n_vars++];
+    entry->parent = var->id;
+    entry->rank = 0;
+    entry->level = infer->level;
+    entry->stamp = 0;
+    entry->var = var;
+    entry->type = NULL;
+}
+
 static type_t *infer_freshvar(infer_t *infer)
 {
-    return type_var_new(NULL, infer->var_id++);
+    type_t *var = type_var_new(infer->arena, SYM_NONE, infer->var_id++);
+    infer_var_add(infer, (type_var_t *)var);
+    return var;
 }
 
-void infer_init(infer_t *infer, env_t *env)
+void infer_init(infer_t *infer, arena_t *arena, env_t *env)
 {
+    infer->arena = arena;
+    arena_init(&infer->scratch);
+
     infer->var_id = 0;
-    infer->unit_type = type_con_new(strdup("()"), 0, NULL);
-    infer->int_type = type_con_new(strdup("Int"), 0, NULL);
-    infer->str_type = type_con_new(strdup("Str"), 0, NULL);
+    infer->n_vars = 0;
+    infer->cap_vars = 0;
+    infer->vars = NULL;
+    infer->find_count = 0;
+    infer->find_hops = 0;
+    infer->level = 0;
+    infer->stamp = 0;
+
+    infer->unit_type = type_con_new_v(infer->arena, SYM_UNIT, 0);
+    infer->int_type = type_con_new_v(infer->arena, SYM_INT, 0);
+    infer->str_type = type_con_new_v(infer->arena, SYM_STR, 0);
     infer->env = env;
 
     // ffi_extern : forall a. Str -> Ffi a
     {
         type_t *ffi_var = infer_freshvar(infer);
-        type_t *ffi_con = type_con_new_v(strdup("Ffi"), 1, ffi_var);
-        type_t *arrow = type_con_new_v(strdup("->"), 2, infer->str_type, ffi_con);
+        type_t *ffi_con = type_con_new_v(infer->arena, SYM_FFI, 1, ffi_var);
+        type_t *arrow = type_con_new_v(infer->arena, SYM_ARROW, 2, infer->str_type, ffi_con);
 
-        infer->ffi_extern_vars = malloc(sizeof(type_id_t));
+        infer->ffi_extern_vars = arena_alloc(infer->arena, sizeof(type_id_t));
         infer->ffi_extern_vars[0] = ((type_var_t *)ffi_var)->id;
 
-        type_scheme_init(&infer->ffi_extern_scheme, arrow, 1, infer->ffi_extern_vars);
-        infer->env = env_append(infer->env, "ffi_extern", (intptr_t)&infer->ffi_extern_scheme);
+        type_scheme_init(infer->arena, &infer->ffi_extern_scheme, arrow, 1, infer->ffi_extern_vars);
+        infer->env = env_append(infer->arena, infer->env, SYM_FFI_EXTERN, (intptr_t)&infer->ffi_extern_scheme);
     }
 
     // ffi_call : forall a b. Ffi (a -> b) -> a -> b
     {
         type_t *ffi_arg = infer_freshvar(infer);
         type_t *ffi_var = infer_freshvar(infer);
-        type_t *ffi_con = type_con_new_v(strdup("Ffi"), 1,
-                                         type_con_new_v(strdup("->"), 2, ffi_arg, ffi_var));
-        type_t *arrow = type_con_new_v(strdup("->"), 2, ffi_con,
-                                       type_con_new_v(strdup("->"), 2, ffi_arg, ffi_var));
+        type_t *ffi_con = type_con_new_v(infer->arena, SYM_FFI, 1,
+                                         type_con_new_v(infer->arena, SYM_ARROW, 2, ffi_arg, ffi_var));
+        type_t *arrow = type_con_new_v(infer->arena, SYM_ARROW, 2, ffi_con,
+                                       type_con_new_v(infer->arena, SYM_ARROW, 2, ffi_arg, ffi_var));
 
-        infer->ffi_call_vars = malloc(2 * sizeof(type_id_t));
+        infer->ffi_call_vars = arena_alloc(infer->arena, 2 * sizeof(type_id_t));
         infer->ffi_call_vars[0] = ((type_var_t *)ffi_arg)->id;
         infer->ffi_call_vars[1] = ((type_var_t *)ffi_var)->id;
 
-        type_scheme_init(&infer->ffi_call_scheme, arrow, 2, infer->ffi_call_vars);
-        infer->env = env_append(infer->env, "ffi_call", (intptr_t)&infer->ffi_call_scheme);
+        type_scheme_init(infer->arena, &infer->ffi_call_scheme, arrow, 2, infer->ffi_call_vars);
+        infer->env = env_append(infer->arena, infer->env, SYM_FFI_CALL, (intptr_t)&infer->ffi_call_scheme);
+    }
+}
+
+static type_id_t infer_var_find(infer_t *infer, type_id_t id)
+{
+    type_id_t root = id;
+    size_t hops = 0;
+
+    while (infer->vars[root].parent != root) {
+        root = infer->vars[root].parent;
+        hops++;
+    }
+
+    // Path compression, every var on the way now points to the root
+    while (infer->vars[id].parent != root) {
+        type_id_t next = infer->vars[id].parent;
+        infer->vars[id].parent = root;
+        id = next;
     }
+
+    infer->find_count++;
+    infer->find_hops += hops;
+    return root;
 }
 
-static bool infer_type_find(type_t *type, type_t **resolve)
+static bool infer_type_find(infer_t *infer, type_t *type, type_t **resolve)
 {
     if (type == NULL)
         return false;
 
-    do {
-        *resolve = type;
-
-        if (type->tag != TYPE_VAR) break;
-        type = ((type_var_t *)type)->forward;
-    } while (type);
+    if (type->tag == TYPE_VAR) {
+        infer_var_t *root = &infer->vars[infer_var_find(infer, ((type_var_t *)type)->id)];
+        type = root->type ? root->type : (type_t *)root->var;
+    }
 
+    *resolve = type;
     return true;
 }
 
-static bool infer_type_resolve(type_t *type, type_t **resolve)
+static bool infer_type_resolve(infer_t *infer, type_t *type, type_t **resolve)
 {
     type_t *res;
-    if (!infer_type_find(type, &res))
+    if (!infer_type_find(infer, type, &res))
         return false;
 
     *resolve = res;
-    if (res->tag == TYPE_CON) {
+    if (res->tag == TYPE_CON && !res->ground) {
         type_con_t *con = (type_con_t *)res;
+        bool ground = true;
 
+        // Resolving the arguments in place keeps the type the same for
+        // every scheme sharing the node
         for (size_t i = 0; i < con->n_args; i++) {
-            if (!infer_type_resolve(con->args[i], &res))
+            if (!infer_type_resolve(infer, con->args[i], &res))
                 return false;
 
             con->args[i] = res;
+            ground &= res->ground;
         }
+
+        // The node is kept unless it turned out to be ground, which has
+        // to be the shared one
+        if (ground)
+            *resolve = type_con_new(infer->arena, con->name, con->n_args, con->args);
     }
     return true;
 }
 
-static bool infer_make_equal_to(type_t *type, type_t *other)
+static bool infer_make_equal_to(infer_t *infer, type_t *type, type_t *other)
 {
     type_t *res;
-    if (!infer_type_find(type, &res))
+    if (!infer_type_find(infer, type, &res))
         return false;
 
     if (res->tag != TYPE_VAR) {
@@ -102,24 +161,51 @@ static bool infer_make_equal_to(type_t *type, type_t *other)
         return false;
     }
 
-    ((type_var_t *)res)->forward = other;
+    infer_var_t *root = &infer->vars[((type_var_t *)res)->id];
+    if (other->tag == TYPE_CON) {
+        root->type = other;
+        return true;
+    }
+
+    // Union by rank, the shallower tree goes under the deeper one
+    infer_var_t *other_root = &infer->vars[((type_var_t *)other)->id];
+    if (root->rank > other_root->rank) {
+        infer_var_t *tmp = root;
+        root = other_root;
+        other_root = tmp;
+    }
+
+    root->parent = other_root->parent;
+    if (root->rank == other_root->rank)
+        other_root->rank++;
+    if (root->level < other_root->level)
+        other_root->level = root->level;
     return true;
 }
 
-static bool infer_type_occurs(type_t *t1, type_t *t2)
+// Also lowers the level of the vars in t2 to the one of t1, since they
+// become reachable from wherever t1 is
+static bool infer_type_occurs(infer_t *infer, type_t *t1, type_t *t2)
 {
     type_t *res;
-    if (!infer_type_find(t2, &res))
+    if (!infer_type_find(infer, t2, &res))
         return false;
 
-    if (res->tag == TYPE_VAR
-        && ((type_var_t *)res)->id == ((type_var_t *)t1)->id)
-        return true;
+    if (res->tag == TYPE_VAR) {
+        type_id_t id = ((type_var_t *)res)->id;
+        if (id == ((type_var_t *)t1)->id)
+            return true;
+
+        uint32_t level = infer->vars[((type_var_t *)t1)->id].level;
+        if (infer->vars[id].level > level)
+            infer->vars[id].level = level;
+        return false;
+    }
 
     if (res->tag == TYPE_CON) {
         type_con_t *con = (type_con_t *)res;
         for (size_t i = 0; i < con->n_args; i++) {
-            if (infer_type_occurs(t1, con->args[i]))
+            if (infer_type_occurs(infer, t1, con->args[i]))
                 return true;
         }
     }
@@ -127,35 +213,40 @@ static bool infer_type_occurs(type_t *t1, type_t *t2)
     return false;
 }
 
-static bool infer_type_unify(type_t *t1, type_t *t2)
+static bool infer_type_unify(infer_t *infer, type_t *t1, type_t *t2)
 {
     type_t *t1_res, *t2_res;
-    if (!infer_type_find(t1, &t1_res) || !infer_type_find(t2, &t2_res))
+    if (!infer_type_find(infer, t1, &t1_res) || !infer_type_find(infer, t2, &t2_res))
         return false;
 
+    if (t1_res == t2_res)
+        return true;
+
     if (t1_res->tag == TYPE_VAR) {
-        if (infer_type_occurs(t1_res, t2_res)) {
+        if (infer_type_occurs(infer, t1_res, t2_res)) {
             printf("Occurs check failed for ");
             type_println(t1_res);
             return false;
         }
-        return infer_make_equal_to(t1_res, t2_res);
+        return infer_make_equal_to(infer, t1_res, t2_res);
     }
 
     if (t2_res->tag == TYPE_VAR) {
-        if (infer_type_occurs(t2_res, t1_res)) {
+        if (infer_type_occurs(infer, t2_res, t1_res)) {
             printf("Occurs check failed for ");
             type_println(t2_res);
             return false;
         }
-        return infer_make_equal_to(t2_res, t1_res);
+        return infer_make_equal_to(infer, t2_res, t1_res);
     }
 
     if (t1_res->tag == TYPE_CON && t2_res->tag == TYPE_CON) {
         type_con_t *t1_con = (type_con_t *)t1_res;
         type_con_t *t2_con = (type_con_t *)t2_res;
 
-        if (strcmp(t1_con->name, t2_con->name) || t1_con->n_args != t2_con->n_args) {
+        // Distinct ground types are never equal
+        if (t1_con->name != t2_con->name || t1_con->n_args != t2_con->n_args
+            || (t1_res->ground && t2_res->ground)) {
             printf("Failed to unify ");
             type_print(t1_res);
             printf(" and ");
@@ -164,7 +255,7 @@ static bool infer_type_unify(type_t *t1, type_t *t2)
         }
 
         for (size_t i = 0; i < t1_con->n_args; i++) {
-            if (!infer_type_unify(t1_con->args[i], t2_con->args[i]))
+            if (!infer_type_unify(infer, t1_con->args[i], t2_con->args[i]))
                 return false;
         }
         return true;
@@ -176,47 +267,36 @@ static bool infer_type_unify(type_t *t1, type_t *t2)
 
 static bool infer_instantiate(infer_t *infer, type_scheme_t *scheme, type_t **type)
 {
-    type_var_t **vars = NULL;
+    // Monomorphic schemes are used as they are
+    if (scheme->n_vars == 0)
+        return type_scheme_instantiate(infer->arena, scheme, NULL, type);
 
-    if (scheme->n_vars > 0) {
-        vars = calloc(scheme->n_vars, sizeof(type_var_t *));
-        for (size_t i = 0; i < scheme->n_vars; i++)
-            vars[i] = (type_var_t *)infer_freshvar(infer);
-    }
+    arena_mark_t mark = arena_save(&infer->scratch);
+    type_var_t **vars = arena_alloc(&infer->scratch, scheme->n_vars * sizeof(type_var_t *));
+    for (size_t i = 0; i < scheme->n_vars; i++)
+        vars[i] = (type_var_t *)infer_freshvar(infer);
 
-    bool ok = type_scheme_instantiate(scheme, vars, type);
-    free(vars);
+    bool ok = type_scheme_instantiate(infer->arena, scheme, vars, type);
+    arena_restore(&infer->scratch, mark);
     return ok;
 }
 
-// FIXME: This is very inefficient and probably incorrect
+// Quantify the vars created at a deeper level than the current one,
+// they cannot be referenced from the environment
 static void infer_collect(infer_t *infer, type_t *type, size_t *n_vars, type_id_t **vars)
 {
     if (type->tag == TYPE_VAR) {
         type_var_t *var = (type_var_t *)type;
+        infer_var_t *entry = &infer->vars[var->id];
 
-        for (env_t *env = infer->env; env; env = env->next) {
-            type_scheme_t *scheme = (type_scheme_t *)env->value;
+        if (entry->level <= infer->level || entry->stamp == infer->stamp)
+            return;
 
-            // If the var is quantified, skip this scheme
-            for (size_t i = 0; i < scheme->n_vars; i++) {
-                if (var->id == scheme->vars[i])
-                    goto next;
-            }
-
-            // If the var is in the scheme's type, stop
-            if (infer_type_occurs(type, scheme->type))
-                return;
-next:;
-        }
-
-        for (size_t i = 0; i < *n_vars; i++) {
-            if (var->id == (*vars)[i])
-                return;
-        }
-
-        *vars = realloc(*vars, ++(*n_vars) * sizeof(type_id_t));
-        (*vars)[*n_vars - 1] = var->id;
+        entry->stamp = infer->stamp;
+        *vars = arena_realloc(infer->arena, *vars,
+                              *n_vars * sizeof(type_id_t),
+                              (*n_vars + 1) * sizeof(type_id_t));
+        (*vars)[(*n_vars)++] = var->id;
         return;
     }
 
@@ -230,13 +310,14 @@ next:;
 static bool infer_generalize(infer_t *infer, type_scheme_t *scheme, type_t *type)
 {
     type_t *res;
-    if (!infer_type_resolve(type, &res))
+    if (!infer_type_resolve(infer, type, &res))
         return false;
 
     size_t n_vars = 0;
     type_id_t *vars = NULL;
+    infer->stamp++;
     infer_collect(infer, res, &n_vars, &vars);
-    type_scheme_init(scheme, res, n_vars, vars);
+    type_scheme_init(infer->arena, scheme, res, n_vars, vars);
     return true;
 }
 
@@ -248,12 +329,14 @@ static bool infer_annotation(infer_t *infer, type_t *type, env_t **subst)
             return true;
 
         int64_t id;
-        if (env_find(*subst, var->name, &id) < 0) {
-            id = infer->var_id++;
-            *subst = env_append(*subst, var->name, id);
+        if (env_find(*subst, var->name, &id)) {
+            var->id = id;
+            return true;
         }
 
-        var->id = id;
+        var->id = infer->var_id++;
+        infer_var_add(infer, var);
+        *subst = env_append(&infer->scratch, *subst, var->name, var->id);
         return true;
     } else if (type->tag == TYPE_CON) {
         type_con_t *con = (type_con_t *)type;
@@ -272,9 +355,13 @@ bool infer_expr(infer_t *infer, expr_t *expr)
 {
     env_t *subst = NULL;
     type_t *annot = expr->type;
+    arena_mark_t mark = arena_save(&infer->scratch);
+
     if (annot && !infer_annotation(infer, annot, &subst))
         return false;
 
+    arena_restore(&infer->scratch, mark);
+
     switch (expr->tag) {
         case EXPR_LIT: {
             expr_lit_t *lit = (expr_lit_t *)expr;
@@ -291,7 +378,7 @@ bool infer_expr(infer_t *infer, expr_t *expr)
                     expr->type = infer->str_type;
                     break;
             }
-            return annot ? infer_type_unify(annot, expr->type) : true;
+            return annot ? infer_type_unify(infer, annot, expr->type) : true;
         }
 
         case EXPR_VAR: {
@@ -299,8 +386,8 @@ bool infer_expr(infer_t *infer, expr_t *expr)
             expr->type = infer_freshvar(infer);
 
             type_scheme_t *scheme;
-            if (env_find(infer->env, var->name, (intptr_t *)&scheme) < 0) {
-                printf("Unbound reference to '%s'\n", var->name);
+            if (!env_find(infer->env, var->name, (intptr_t *)&scheme)) {
+                printf("Unbound reference to '%s'\n", sym_name(var->name));
                 return false;
             }
 
@@ -311,10 +398,10 @@ bool infer_expr(infer_t *infer, expr_t *expr)
                 return false;
             }
 
-            if (annot && !infer_type_unify(annot, expr->type))
+            if (annot && !infer_type_unify(infer, annot, expr->type))
                 return false;
 
-            return infer_type_unify(expr->type, inst);
+            return infer_type_unify(infer, expr->type, inst);
         }
 
         case EXPR_LAMBDA: {
@@ -323,25 +410,25 @@ bool infer_expr(infer_t *infer, expr_t *expr)
             type_t *fresh = infer_freshvar(infer);
 
             type_scheme_t scheme;
-            type_scheme_init(&scheme, fresh, 0, NULL);
+            type_scheme_init(infer->arena, &scheme, fresh, 0, NULL);
 
             env_t *env = infer->env;
-            infer->env = env_append(env, lam->bound, (intptr_t)&scheme);
+            mark = arena_save(&infer->scratch);
+            infer->env = env_append(&infer->scratch, env, lam->bound, (intptr_t)&scheme);
 
             if (!infer_expr(infer, lam->body)) {
                 printf("Failed to infer lambda body\n");
                 return false;
             }
 
-            type_t **args = malloc(sizeof(type_t *) * 2);
-            args[0] = fresh;
-            args[1] = lam->body->type;
-
-            if (annot && !infer_type_unify(annot, expr->type))
+            if (annot && !infer_type_unify(infer, annot, expr->type))
                 return false;
 
             infer->env = env_clear(infer->env, env);
-            return infer_type_unify(expr->type, type_con_new("->", 2, args));
+            arena_restore(&infer->scratch, mark);
+
+            type_t *arrow = type_con_new_v(infer->arena, SYM_ARROW, 2, fresh, lam->body->type);
+            return infer_type_unify(infer, expr->type, arrow);
         }
 
         case EXPR_APPLY: {
@@ -358,25 +445,23 @@ bool infer_expr(infer_t *infer, expr_t *expr)
                 return false;
             }
 
-            type_t **args = malloc(sizeof(type_t *) * 2);
-            args[0] = app->arg->type;
-            args[1] = expr->type;
-
-            if (annot && !infer_type_unify(annot, expr->type))
+            if (annot && !infer_type_unify(infer, annot, expr->type))
                 return false;
 
-            type_t *arrow = type_con_new("->", 2, args);
-            return infer_type_unify(app->fun->type, arrow);
+            type_t *arrow = type_con_new_v(infer->arena, SYM_ARROW, 2, app->arg->type, expr->type);
+            return infer_type_unify(infer, app->fun->type, arrow);
         }
 
         case EXPR_LET: {
             expr_let_t *let = (expr_let_t *)expr;
             expr->type = infer_freshvar(infer);
 
+            infer->level++;
             if (!infer_expr(infer, let->value)) {
                 printf("Failed to infer let value\n");
                 return false;
             }
+            infer->level--;
 
             if (!infer_generalize(infer, &let->scheme, let->value->type)) {
                 printf("Failed to generalize let\n");
@@ -384,17 +469,19 @@ bool infer_expr(infer_t *infer, expr_t *expr)
             }
 
             env_t *env = infer->env;
-            infer->env = env_append(env, let->bound, (intptr_t)&let->scheme);
+            mark = arena_save(&infer->scratch);
+            infer->env = env_append(&infer->scratch, env, let->bound, (intptr_t)&let->scheme);
             if (!infer_expr(infer, let->body)) {
                 printf("Failed to infer let body\n");
                 return false;
             }
 
-            if (annot && !infer_type_unify(annot, expr->type))
+            if (annot && !infer_type_unify(infer, annot, expr->type))
                 return false;
 
             infer->env = env_clear(infer->env, env);
-            return infer_type_unify(expr->type, let->body->type);
+            arena_restore(&infer->scratch, mark);
+            return infer_type_unify(infer, expr->type, let->body->type);
         }
     }
 
@@ -404,7 +491,7 @@ bool infer_expr(infer_t *infer, expr_t *expr)
 bool infer_resolve(infer_t *infer, expr_t *expr)
 {
     type_t *res;
-    if (!infer_type_resolve(expr->type, &res))
+    if (!infer_type_resolve(infer, expr->type, &res))
         return false;
 
     expr->type = res;
@@ -439,6 +526,7 @@ bool infer_decl(infer_t *infer, decl_t *decl)
         case DECL_LET: {
             decl_let_t *let = (decl_let_t *)decl;
 
+            infer->level++;
             if (!infer_expr(infer, let->value)) {
                 printf("Failed to infer let value\n");
                 return false;
@@ -451,25 +539,48 @@ bool infer_decl(infer_t *infer, decl_t *decl)
 
             env_t *subst = NULL;
             type_t *annot = let->scheme.type;
+            arena_mark_t mark = arena_save(&infer->scratch);
+
             if (annot && !infer_annotation(infer, annot, &subst))
                 return false;
 
-            if (annot && !infer_type_unify(annot, let->value->type))
+            arena_restore(&infer->scratch, mark);
+
+            if (annot && !infer_type_unify(infer, annot, let->value->type))
                 return false;
 
+            infer->level--;
             if (!infer_generalize(infer, &let->scheme, let->value->type)) {
                 printf("Failed to generalize let type\n");
                 return false;
             }
 
-            infer->env = env_append(infer->env, let->bound, (intptr_t)&let->scheme);
+            infer->env = env_append(infer->arena, infer->env, let->bound, (intptr_t)&let->scheme);
             return true;
         }
     }
     return false;
 }
 
+void infer_print_stats(infer_t *infer)
+{
+    // Chain length seen by finds, then what is left after compression
+    size_t depth = 0;
+    for (type_id_t id = 0; id < infer->n_vars; id++) {
+        for (type_id_t i = id; infer->vars[i].parent != i; i = infer->vars[i].parent)
+            depth++;
+    }
+
+    printf("Type variables: %zu, finds: %zu walking %.2f links on average, "
+           "%.2f links per variable left after compression\n",
+           infer->n_vars,
+           infer->find_count,
+           infer->find_count ? (double)infer->find_hops / infer->find_count : 0.0,
+           infer->n_vars ? (double)depth / infer->n_vars : 0.0);
+}
+
 void infer_free(infer_t *infer)
 {
-    // TODO
+    free(infer->vars);
+    arena_free(&infer->scratch);
 }
@@ -3,13 +3,33 @@
 
 #include <stdbool.h>
 
+#include "arena.h"
 #include "type.h"
 #include "decl.h"
 #include "expr.h"
 #include "env.h"
 
+// Union-find entry for a type variable id
 typedef struct {
+    type_id_t parent;
+    uint32_t rank;
+    uint32_t level;
+    uint32_t stamp;
+    type_var_t *var;
+    type_t *type;
+} infer_var_t;
+
+typedef struct {
+    arena_t *arena;
+    arena_t scratch;
     uint32_t var_id;
+    uint32_t level;
+    uint32_t stamp;
+    size_t n_vars;
+    size_t cap_vars;
+    infer_var_t *vars;
+    size_t find_count;
+    size_t find_hops;
     env_t *env;
     type_t *unit_type;
     type_t *int_type;
@@ -20,7 +40,7 @@ typedef struct {
     type_id_t *ffi_call_vars;
 } infer_t;
 
-void infer_init(infer_t *infer, env_t *env);
+void infer_init(infer_t *infer, arena_t *arena, env_t *env);
 
 bool infer_expr(infer_t *infer, expr_t *expr);
 
@@ -28,6 +48,8 @@ bool infer_resolve(infer_t *infer, expr_t *expr);
 
 bool infer_decl(infer_t *infer, decl_t *decl);
 
+void infer_print_stats(infer_t *infer);
+
 void infer_free(infer_t *infer);
 
 #endif
@@ -0,0 +1,234 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+
+void ir_func_init(ir_func_t *func, arena_t *arena, sym_t name)
+{
+    memset(func, 0, sizeof(ir_func_t));
+    func->arena = arena;
+    func->name = name;
+}
+
+static ir_inst_t *ir_inst(ir_func_t *func, ir_op_t op)
+{
+    if (func->n_insts == func->cap_insts) {
+        size_t cap = func->cap_insts ? func->cap_insts * 2 : 16;
+        func->insts = arena_realloc(func->arena, func->insts,
+                                    func->cap_insts * sizeof(ir_inst_t),
+                                    cap * sizeof(ir_inst_t));
+        func->cap_insts = cap;
+    }
+
+    ir_inst_t *inst = &func->insts[func->n_insts++];
+    *inst = (ir_inst_t){ .op = op, .dst = IR_NONE, .a = IR_NONE, .b = IR_NONE };
+    return inst;
+}
+
+static ir_reg_t ir_def(ir_func_t *func, ir_inst_t *inst)
+{
+    return inst->dst = func->n_regs++;
+}
+
+ir_reg_t ir_param(ir_func_t *func, int64_t index)
+{
+    ir_inst_t *inst = ir_inst(func, IR_PARAM);
+    inst->imm = index;
+    return ir_def(func, inst);
+}
+
+ir_reg_t ir_imm(ir_func_t *func, int64_t imm)
+{
+    ir_inst_t *inst = ir_inst(func, IR_IMM);
+    inst->imm = imm;
+    return ir_def(func, inst);
+}
+
+ir_reg_t ir_addr(ir_func_t *func, sym_t sym)
+{
+    ir_inst_t *inst = ir_inst(func, IR_ADDR);
+    inst->sym = sym;
+    return ir_def(func, inst);
+}
+
+ir_reg_t ir_got(ir_func_t *func, sym_t sym)
+{
+    ir_inst_t *inst = ir_inst(func, IR_GOT);
+    inst->sym = sym;
+    return ir_def(func, inst);
+}
+
+ir_reg_t ir_load(ir_func_t *func, ir_reg_t base, int64_t disp)
+{
+    ir_inst_t *inst = ir_inst(func, IR_LOAD);
+    inst->a = base;
+    inst->imm = disp;
+    return ir_def(func, inst);
+}
+
+void ir_store(ir_func_t *func, ir_reg_t base, int64_t disp, ir_reg_t src)
+{
+    ir_inst_t *inst = ir_inst(func, IR_STORE);
+    inst->a = base;
+    inst->b = src;
+    inst->imm = disp;
+}
+
+ir_reg_t ir_alloc(ir_func_t *func, int64_t size)
+{
+    ir_inst_t *inst = ir_inst(func, IR_ALLOC);
+    inst->imm = size;
+    return ir_def(func, inst);
+}
+
+ir_reg_t ir_frame(ir_func_t *func, int64_t size)
+{
+    ir_inst_t *inst = ir_inst(func, IR_FRAME);
+    inst->imm = func->frame_size;
+    func->frame_size += size;
+    return ir_def(func, inst);
+}
+
+ir_reg_t ir_load_sym(ir_func_t *func, sym_t sym)
+{
+    ir_inst_t *inst = ir_inst(func, IR_LOAD_SYM);
+    inst->sym = sym;
+    return ir_def(func, inst);
+}
+
+void ir_store_sym(ir_func_t *func, sym_t sym, ir_reg_t src)
+{
+    ir_inst_t *inst = ir_inst(func, IR_STORE_SYM);
+    inst->sym = sym;
+    inst->a = src;
+}
+
+static void ir_args(ir_func_t *func, ir_inst_t *inst, uint32_t n_args, const ir_reg_t *args)
+{
+    assert(n_args <= IR_MAX_ARGS);
+    inst->n_args = n_args;
+    inst->args = arena_alloc(func->arena, n_args * sizeof(ir_reg_t));
+    if (n_args > 0)
+        memcpy(inst->args, args, n_args * sizeof(ir_reg_t));
+}
+
+ir_reg_t ir_call(ir_func_t *func, ir_reg_t closure, ir_reg_t arg)
+{
+    ir_inst_t *inst = ir_inst(func, IR_CALL);
+    ir_args(func, inst, 2, (ir_reg_t[]){ closure, arg });
+    return ir_def(func, inst);
+}
+
+ir_reg_t ir_call_sym(ir_func_t *func, sym_t sym, uint32_t n_args, const ir_reg_t *args)
+{
+    ir_inst_t *inst = ir_inst(func, IR_CALL_SYM);
+    inst->sym = sym;
+    ir_args(func, inst, n_args, args);
+    return ir_def(func, inst);
+}
+
+ir_reg_t ir_call_c(ir_func_t *func, ir_reg_t slot, ir_reg_t arg)
+{
+    ir_inst_t *inst = ir_inst(func, IR_CALL_C);
+    inst->a = slot;
+    ir_args(func, inst, 1, &arg);
+    return ir_def(func, inst);
+}
+
+// Whether reg is the address of something in the frame
+static bool ir_in_frame(ir_func_t *func, ir_reg_t reg)
+{
+    for (size_t i = 0; i < func->n_insts; i++) {
+        if (func->insts[i].dst == reg)
+            return func->insts[i].op == IR_FRAME;
+    }
+    return false;
+}
+
+void ir_ret(ir_func_t *func, ir_reg_t src)
+{
+    ir_inst_t *last = func->n_insts ? &func->insts[func->n_insts - 1] : NULL;
+    bool tail = last && src != IR_NONE && last->dst == src
+        && (last->op == IR_CALL || last->op == IR_CALL_SYM || last->op == IR_CALL_C);
+
+    // The frame is gone by the time the callee runs
+    for (uint32_t i = 0; tail && i < last->n_args; i++)
+        tail = last->args[i] == IR_NONE || !ir_in_frame(func, last->args[i]);
+
+    if (tail) {
+        last->tail = true;
+        return;
+    }
+
+    ir_inst_t *inst = ir_inst(func, IR_RET);
+    inst->a = src;
+}
+
+static const char *ops[] = {
+    [IR_PARAM] = "param",
+    [IR_IMM] = "imm",
+    [IR_ADDR] = "addr",
+    [IR_GOT] = "got",
+    [IR_LOAD] = "load",
+    [IR_STORE] = "store",
+    [IR_ALLOC] = "alloc",
+    [IR_FRAME] = "frame",
+    [IR_LOAD_SYM] = "load",
+    [IR_STORE_SYM] = "store",
+    [IR_CALL] = "call",
+    [IR_CALL_SYM] = "call",
+    [IR_CALL_C] = "call",
+    [IR_RET] = "ret",
+};
+
+void ir_print(ir_func_t *func)
+{
+    printf("%s:\n", sym_name(func->name));
+
+    for (size_t i = 0; i < func->n_insts; i++) {
+        ir_inst_t *inst = &func->insts[i];
+
+        fputs("\t", stdout);
+        if (inst->dst != IR_NONE)
+            printf("v%u = ", inst->dst);
+        if (inst->tail)
+            fputs("tail ", stdout);
+        fputs(ops[inst->op], stdout);
+
+        switch (inst->op) {
+            case IR_ADDR:
+            case IR_GOT:
+            case IR_LOAD_SYM:
+            case IR_STORE_SYM:
+            case IR_CALL_SYM:
+                printf(" %s", sym_name(inst->sym));
+                break;
+
+            case IR_PARAM:
+            case IR_IMM:
+            case IR_LOAD:
+            case IR_STORE:
+            case IR_ALLOC:
+            case IR_FRAME:
+                printf(" %ld", inst->imm);
+                break;
+
+            default:
+                break;
+        }
+
+        if (inst->a != IR_NONE)
+            printf(" v%u", inst->a);
+        if (inst->b != IR_NONE)
+            printf(" v%u", inst->b);
+        for (uint32_t j = 0; j < inst->n_args; j++) {
+            if (inst->args[j] == IR_NONE)
+                fputs(" _", stdout);
+            else
+                printf(" v%u", inst->args[j]);
+        }
+        puts("");
+    }
+}
@@ -0,0 +1,127 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "sym.h"
+
+// Marks an unused operand or result
+#define IR_NONE UINT32_MAX
+
+// Calls pass at most this many words in registers
+#define IR_MAX_ARGS 6
+
+typedef uint32_t ir_reg_t;
+
+typedef enum {
+    // dst = incoming argument imm (0 is the closure, then the arguments)
+    IR_PARAM,
+    // dst = imm
+    IR_IMM,
+    // dst = address of sym
+    IR_ADDR,
+    // dst = address of the GOT slot of the extern sym
+    IR_GOT,
+    // dst = *(a + imm)
+    IR_LOAD,
+    // *(a + imm) = b
+    IR_STORE,
+    // dst = imm fresh bytes from the nursery
+    IR_ALLOC,
+    // dst = address of the bytes at imm in the frame, see frame_size
+    IR_FRAME,
+    // dst = *sym
+    IR_LOAD_SYM,
+    // *sym = a
+    IR_STORE_SYM,
+    // dst = call of the closure args[0] with the argument args[1]
+    IR_CALL,
+    // dst = sym(args...), with dst and any of args left out
+    IR_CALL_SYM,
+    // dst = call of the C function at *a with the argument args[0]
+    IR_CALL_C,
+    // return a, or nothing
+    IR_RET,
+} ir_op_t;
+
+typedef struct {
+    ir_op_t op;
+    ir_reg_t dst;
+    ir_reg_t a;
+    ir_reg_t b;
+    int64_t imm;
+    sym_t sym;
+    uint32_t n_args;
+    ir_reg_t *args;
+    // Calls only: jumps to the callee in place of returning its result,
+    // ending the function
+    bool tail;
+} ir_inst_t;
+
+// Where the register allocator put a virtual register
+typedef struct {
+    bool used;
+    bool spilled;
+    // asm_reg_t, or the spill slot index
+    uint8_t reg;
+    uint32_t slot;
+} ir_loc_t;
+
+// A function as a straight-line list of instructions on virtual registers
+typedef struct {
+    arena_t *arena;
+    sym_t name;
+    bool global;
+    uint32_t n_regs;
+    size_t n_insts;
+    size_t cap_insts;
+    ir_inst_t *insts;
+    // Bytes taken by IR_FRAME, above the spill slots
+    size_t frame_size;
+
+    // Filled in by regalloc_func
+    ir_loc_t *locs;
+    uint32_t n_slots;
+    uint32_t saved;
+    // Whether the stack has to be aligned for calls
+    bool calls;
+} ir_func_t;
+
+void ir_func_init(ir_func_t *func, arena_t *arena, sym_t name);
+
+ir_reg_t ir_param(ir_func_t *func, int64_t index);
+
+ir_reg_t ir_imm(ir_func_t *func, int64_t imm);
+
+ir_reg_t ir_addr(ir_func_t *func, sym_t sym);
+
+ir_reg_t ir_got(ir_func_t *func, sym_t sym);
+
+ir_reg_t ir_load(ir_func_t *func, ir_reg_t base, int64_t disp);
+
+void ir_store(ir_func_t *func, ir_reg_t base, int64_t disp, ir_reg_t src);
+
+ir_reg_t ir_alloc(ir_func_t *func, int64_t size);
+
+ir_reg_t ir_frame(ir_func_t *func, int64_t size);
+
+ir_reg_t ir_load_sym(ir_func_t *func, sym_t sym);
+
+void ir_store_sym(ir_func_t *func, sym_t sym, ir_reg_t src);
+
+ir_reg_t ir_call(ir_func_t *func, ir_reg_t closure, ir_reg_t arg);
+
+ir_reg_t ir_call_sym(ir_func_t *func, sym_t sym, uint32_t n_args, const ir_reg_t *args);
+
+ir_reg_t ir_call_c(ir_func_t *func, ir_reg_t slot, ir_reg_t arg);
+
+// Returning the result of the call just made turns it into a tail call,
+// unless the call is given something in the frame
+void ir_ret(ir_func_t *func, ir_reg_t src);
+
+void ir_print(ir_func_t *func);
+
+#endif
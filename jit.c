@@ -0,0 +1,140 @@
+#include <dlfcn.h>
+#include <elf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "gc.h"
+#include "jit.h"
+
+// Every extern gets a GOT slot and a `jmp *slot(%rip)` stub
+#define JIT_STUB_SIZE 8
+
+static size_t jit_align(size_t size, size_t align)
+{
+    return (size + align - 1) & ~(align - 1);
+}
+
+bool jit_load(jit_t *jit, asm_t *as)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    // Externs are numbered in elf_index, there is no symbol table here
+    size_t n_externs = 0;
+    for (size_t i = 0; i < as->n_labels; i++) {
+        if (!as->labels[i].defined)
+            as->labels[i].elf_index = n_externs++;
+    }
+
+    // Code and stubs, then read-only data and addresses, then .bss and the
+    // GOT, each on their own pages so they can be protected separately
+    size_t text_size = as->sections[ASM_TEXT].len;
+    size_t stubs = jit_align(text_size, JIT_STUB_SIZE);
+    size_t rodata = jit_align(stubs + n_externs * JIT_STUB_SIZE, page);
+    size_t data = jit_align(rodata + as->sections[ASM_RODATA].len, 8);
+    size_t bss = jit_align(data + as->sections[ASM_DATA].len, page);
+    size_t got = jit_align(bss + as->sections[ASM_BSS].len, 8);
+    size_t size = jit_align(got + n_externs * sizeof(void *), page);
+
+    char *base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+
+    jit->base = base;
+    jit->size = size;
+    jit->main = NULL;
+
+    memcpy(base, as->sections[ASM_TEXT].data, text_size);
+    if (as->sections[ASM_RODATA].len > 0)
+        memcpy(base + rodata, as->sections[ASM_RODATA].data, as->sections[ASM_RODATA].len);
+    if (as->sections[ASM_DATA].len > 0)
+        memcpy(base + data, as->sections[ASM_DATA].data, as->sections[ASM_DATA].len);
+
+    const size_t starts[ASM_SECTIONS] = {
+        [ASM_TEXT] = 0,
+        [ASM_RODATA] = rodata,
+        [ASM_DATA] = data,
+        [ASM_BSS] = bss,
+    };
+
+    for (size_t i = 0; i < as->n_labels; i++) {
+        asm_label_t *label = &as->labels[i];
+        if (label->defined) {
+            if (label->name == SYM_MAIN)
+                jit->main = (int (*)(void))(base + label->offset);
+            continue;
+        }
+
+        void *addr = dlsym(RTLD_DEFAULT, sym_name(label->name));
+        if (addr == NULL) {
+            printf("Unresolved extern '%s'\n", sym_name(label->name));
+            jit_free(jit);
+            return false;
+        }
+
+        char *slot = base + got + label->elf_index * sizeof(void *);
+        char *stub = base + stubs + label->elf_index * JIT_STUB_SIZE;
+        int32_t rel = slot - (stub + 6);
+
+        memcpy(slot, &addr, sizeof(void *));
+        memcpy(stub, "\xFF\x25", 2);
+        memcpy(stub + 2, &rel, 4);
+    }
+
+    // Fixups in .text are rel32, and the whole region is well within their
+    // range. Those in data are absolute.
+    for (size_t i = 0; i < as->n_fixups; i++) {
+        asm_fixup_t *fixup = &as->fixups[i];
+        asm_label_t *label = &as->labels[fixup->label];
+
+        char *target;
+        if (label->defined)
+            target = base + starts[label->section] + label->offset;
+        else if (fixup->type == R_X86_64_GOTPCREL)
+            target = base + got + label->elf_index * sizeof(void *);
+        else
+            target = base + stubs + label->elf_index * JIT_STUB_SIZE;
+
+        char *field = base + starts[fixup->section] + fixup->offset;
+        if (fixup->type == R_X86_64_64) {
+            memcpy(field, &target, sizeof(char *));
+            continue;
+        }
+
+        int32_t rel = target - (field + 4);
+        memcpy(field, &rel, 4);
+    }
+
+    if (jit->main == NULL) {
+        printf("No main function to run\n");
+        jit_free(jit);
+        return false;
+    }
+
+    if (mprotect(base, rodata, PROT_READ | PROT_EXEC) < 0
+        || mprotect(base + rodata, bss - rodata, PROT_READ) < 0) {
+        perror("mprotect");
+        jit_free(jit);
+        return false;
+    }
+    return true;
+}
+
+int jit_run(jit_t *jit)
+{
+    // The closures of the unit go with it
+    int status = jit->main();
+    gc_reset();
+    return status;
+}
+
+void jit_free(jit_t *jit)
+{
+    munmap(jit->base, jit->size);
+}
@@ -0,0 +1,22 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "asm.h"
+
+// Code and data of one unit, loaded into this process
+typedef struct {
+    char *base;
+    size_t size;
+    int (*main)(void);
+} jit_t;
+
+bool jit_load(jit_t *jit, asm_t *as);
+
+int jit_run(jit_t *jit);
+
+void jit_free(jit_t *jit);
+
+#endif
@@ -1,8 +1,50 @@
-#include <ctype.h>
+#include <stdint.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "lex.h"
 
+#define LEX_SPACE (1 << 0)
+#define LEX_ALPHA (1 << 1)
+#define LEX_DIGIT (1 << 2)
+#define LEX_IDENT (LEX_ALPHA | LEX_DIGIT)
+
+#define LEX_SHORT 8
+
+// Character classes of the C locale, indexed by byte
+static const uint8_t lex_class[256] = {
+    ['\t' ... '\r'] = LEX_SPACE,
+    [' '] = LEX_SPACE,
+    ['0' ... '9'] = LEX_DIGIT,
+    ['A' ... 'Z'] = LEX_ALPHA,
+    ['a' ... 'z'] = LEX_ALPHA,
+    ['_'] = LEX_ALPHA,
+};
+
+typedef struct {
+    const char *str;
+    size_t len;
+    token_type_t type;
+} keyword_t;
+
+#define LEX_KEYWORD_SLOTS 32
+
+// Indexed by lex_keyword_hash, which is perfect over the planned keywords:
+//   then 2, of 3, type 7, match 10, let 11, and 16, with 19, in 21,
+//   else 24, if 29, rec 30
+static const keyword_t keywords[LEX_KEYWORD_SLOTS] = {
+    [11] = { "let", 3, TOK_LET },
+    [21] = { "in", 2, TOK_IN },
+};
+
+static size_t lex_keyword_hash(const char *str, size_t len)
+{
+    return ((uint8_t)str[0] + 3 * (uint8_t)str[len - 1] + len) & (LEX_KEYWORD_SLOTS - 1);
+}
+
 void lex_init(lex_t *lex, const char *src, size_t len)
 {
     lex->line = 1;
@@ -34,63 +76,113 @@ static void lex_error(lex_t *lex, token_t *tok, const char *error)
 
 static char lex_peek(lex_t *lex)
 {
-    return lex_eof(lex) ? '\0' : lex->src[lex->off];
+    // The source is followed by LEX_PADDING zero bytes
+    return lex->src[lex->off];
 }
 
-static void lex_skip(lex_t *lex)
+#ifdef __SSE2__
+static unsigned lex_space_mask(const char *src, unsigned *newline)
 {
-    while (true) {
-        char c = lex_peek(lex);
-        if (c == '\n')
-            lex->line++;
+    __m128i c = _mm_loadu_si128((const __m128i *)src);
+    __m128i ctrl = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('\t' - 1)),
+                                 _mm_cmplt_epi8(c, _mm_set1_epi8('\r' + 1)));
+    __m128i space = _mm_or_si128(ctrl, _mm_cmpeq_epi8(c, _mm_set1_epi8(' ')));
+
+    *newline = _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n')));
+    return _mm_movemask_epi8(space);
+}
 
-        if (!isspace(c))
-            return;
+static unsigned lex_ident_mask(const char *src)
+{
+    __m128i c = _mm_loadu_si128((const __m128i *)src);
+    __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+    __m128i under = _mm_cmpeq_epi8(c, _mm_set1_epi8('_'));
+
+    return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), under));
+}
+#endif
 
+static void lex_skip(lex_t *lex)
+{
+    // Most runs are a single space, only go wide on longer ones
+    while (lex_class[(uint8_t)lex_peek(lex)] & LEX_SPACE) {
+        if (lex_peek(lex) == '\n')
+            lex->line++;
         lex->off++;
+
+#ifdef __SSE2__
+        if (lex_class[(uint8_t)lex_peek(lex)] & LEX_SPACE) {
+            while (true) {
+                unsigned newline;
+                unsigned space = lex_space_mask(lex->src + lex->off, &newline);
+
+                if (space == 0xFFFF) {
+                    lex->line += __builtin_popcount(newline);
+                    lex->off += 16;
+                    continue;
+                }
+
+                unsigned n = __builtin_ctz(~space);
+                lex->line += __builtin_popcount(newline & ((1u << n) - 1));
+                lex->off += n;
+                return;
+            }
+        }
+#endif
     }
 }
 
 static void lex_ident(lex_t *lex, token_t *next)
 {
-    char c;
+    // Short names are the common case, only go wide past LEX_SHORT bytes
+    size_t end = lex->off + LEX_SHORT;
     do {
         lex->off++;
-        c = lex_peek(lex);
-    } while (isalnum(c) || c == '_');
+    } while (lex->off < end && lex_class[(uint8_t)lex_peek(lex)] & LEX_IDENT);
+
+#ifdef __SSE2__
+    while (lex->off == end) {
+        unsigned ident = lex_ident_mask(lex->src + lex->off);
+        lex->off += __builtin_ctz(~ident | 0x10000);
+        end += 16;
+    }
+#else
+    while (lex_class[(uint8_t)lex_peek(lex)] & LEX_IDENT)
+        lex->off++;
+#endif
 
     lex_token(lex, next, TOK_IDENT);
-    if (!strncmp("let", next->str, 3))
-        next->type = TOK_LET;
-    else if (!strncmp("in", next->str, 2))
-        next->type = TOK_IN;
+
+    const keyword_t *keyword = &keywords[lex_keyword_hash(next->str, next->len)];
+    if (keyword->len == next->len && !memcmp(keyword->str, next->str, next->len))
+        next->type = keyword->type;
+    else
+        next->sym = sym_intern(next->str, next->len);
 }
 
 static void lex_number(lex_t *lex, token_t *next)
 {
-    char c;
     do {
         lex->off++;
-        c = lex_peek(lex);
-    } while (isdigit(c));
+    } while (lex_class[(uint8_t)lex_peek(lex)] & LEX_DIGIT);
 
     lex_token(lex, next, TOK_NUMBER);
 }
 
 static void lex_string(lex_t *lex, token_t *next)
 {
-    char c;
-    do {
-        lex->off++;
-        c = lex_peek(lex);
-    } while (!lex_eof(lex) && c != '"');
-
-    if (lex_eof(lex)) {
+    const char *end = memchr(lex->src + lex->off, '"', lex->len - lex->off);
+    if (end == NULL) {
+        lex->off = lex->len;
         lex_error(lex, next, "Unterminated string");
         return;
     }
 
-    lex->off++;
+    lex->off = end - lex->src + 1;
     lex_token(lex, next, TOK_STRING);
 }
 
@@ -106,10 +198,12 @@ void lex_next(lex_t *lex, token_t *next)
     }
 
     char c = lex_peek(lex);
-    if (isalpha(c) || c == '_')
+    uint8_t class = lex_class[(uint8_t)c];
+
+    if (class & LEX_ALPHA)
         return lex_ident(lex, next);
 
-    if (isdigit(c))
+    if (class & LEX_DIGIT)
         return lex_number(lex, next);
 
     lex->off++;
@@ -5,6 +5,11 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "sym.h"
+
+// Bytes past the end of the source that must be readable and zero
+#define LEX_PADDING 64
+
 typedef enum {
     TOK_EOF,
     TOK_IDENT,
@@ -31,6 +36,7 @@ typedef struct {
     uint32_t line;
     const char *str;
     size_t len;
+    sym_t sym;
 } token_t;
 
 typedef struct {
@@ -42,6 +48,7 @@ typedef struct {
     uint32_t tok_line;
 } lex_t;
 
+// src must be followed by LEX_PADDING zero bytes
 void lex_init(lex_t *lex, const char *src, size_t len);
 
 void lex_next(lex_t *lex, token_t *next);
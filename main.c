@@ -1,62 +1,112 @@
+#include <pthread.h>
+#include <spawn.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "arena.h"
+#include "asm.h"
 #include "compile.h"
 #include "decl.h"
 #include "infer.h"
+#include "jit.h"
+#include "mono.h"
 #include "parse.h"
+#include "simplify.h"
+#include "sym.h"
+#include "type.h"
 
-int main(int argc, const char **argv)
+extern char **environ;
+
+typedef struct {
+    bool debug;
+    bool stats;
+    bool emit_asm;
+    bool run;
+    // AST nodes monomorphization may add, 0 when it is off
+    size_t mono_budget;
+    char *runtime;
+    size_t n_paths;
+    const char **paths;
+    atomic_size_t next;
+    atomic_bool failed;
+} driver_t;
+
+// Output paths: foo.nml gives foo.o (or foo.S) and foo, anything else
+// gets the suffixes appended
+static void unit_outputs(const char *path, bool emit_asm, char **obj_path, char **exe_path)
 {
-    bool debug = false;
-    if (argc == 3 && !strcmp(argv[1], "--debug")) {
-        argc--;
-        argv[1] = argv[2];
-        debug = true;
-    }
+    size_t len = strlen(path);
+    const char *ext = ".nml";
+    size_t ext_len = strlen(ext);
 
-    if (argc != 2) {
-        printf("Usage: %s [--debug] PATH\n", argv[0]);
-        return 1;
-    }
+    bool strip = len > ext_len && !strcmp(path + len - ext_len, ext);
+    size_t base = strip ? len - ext_len : len;
 
-    int fd = open(argv[1], O_RDONLY);
-    if (fd < 0) {
-        perror("open");
-        return 1;
-    }
+    *obj_path = malloc(base + sizeof(".S"));
+    sprintf(*obj_path, "%.*s%s", (int)base, path, emit_asm ? ".S" : ".o");
 
-    struct stat st;
-    if (fstat(fd, &st) < 0) {
-        perror("fstat");
-        close(fd);
-        return 1;
+    *exe_path = malloc(base + sizeof(".out"));
+    sprintf(*exe_path, "%.*s%s", (int)base, path, strip ? "" : ".out");
+}
+
+static bool unit_link(const char *obj_path, const char *runtime, const char *exe_path)
+{
+    char *argv[] = {
+        "gcc", (char *)obj_path, (char *)runtime, "-g", "-fpie", "-o", (char *)exe_path, NULL
+    };
+
+    pid_t pid;
+    int status;
+    if (posix_spawnp(&pid, "gcc", NULL, NULL, argv, environ) != 0) {
+        perror("posix_spawnp");
+        return false;
     }
 
-    size_t size = st.st_size;
-    void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (mapped == MAP_FAILED) {
-        perror("mmap");
-        close(fd);
-        return 1;
+    if (waitpid(pid, &status, 0) < 0) {
+        perror("waitpid");
+        return false;
     }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static double unit_elapsed(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static bool unit_compile(driver_t *driver, const char *path, const char *src, size_t size,
+                         const char *obj_path, struct timespec *start)
+{
+    bool debug = driver->debug;
+
+    arena_t arena;
+    arena_init(&arena);
 
     parse_t parse;
-    parse_init(&parse, mapped, size);
+    parse_init(&parse, &arena, src, size);
 
     decl_t **decls = NULL;
     size_t n_decls = 0;
 
+    bool ok = true;
+
     decl_t *decl;
     while (!parse_eof(&parse)) {
         if (!parse_decl(&parse, &decl)) {
-            printf("Aborted parsing\n");
-            exit(1);
+            printf("%s: Aborted parsing\n", path);
+            ok = false;
+            break;
         }
 
         if (debug) {
@@ -68,15 +118,18 @@ int main(int argc, const char **argv)
         decls[n_decls - 1] = decl;
     }
 
+    size_t parse_bytes = arena.allocated;
+
     infer_t infer;
-    infer_init(&infer, NULL);
+    infer_init(&infer, &arena, NULL);
 
-    for (size_t i = 0; i < n_decls; i++) {
+    for (size_t i = 0; ok && i < n_decls; i++) {
         decl_t *decl = decls[i];
 
         if (!infer_decl(&infer, decl)) {
-            puts("Failed to infer types");
-            return 1;
+            printf("%s: Failed to infer types\n", path);
+            ok = false;
+            break;
         }
 
         if (debug) {
@@ -85,38 +138,297 @@ int main(int argc, const char **argv)
         }
     }
 
-    FILE *out = fopen("out.S", "wb");
+    if (ok && debug)
+        infer_print_stats(&infer);
+
+    size_t infer_bytes = arena.allocated - parse_bytes;
+
+    mono_t mono;
+    mono_init(&mono, &arena, driver->mono_budget);
+
+    if (ok && driver->mono_budget > 0) {
+        if (!mono_program(&mono, &decls, &n_decls)) {
+            printf("%s: Failed to monomorphize\n", path);
+            ok = false;
+        }
+
+        for (size_t i = 0; ok && debug && i < n_decls; i++) {
+            printf("Monomorphic decl: ");
+            decl_println(decls[i]);
+        }
+    }
+
+    size_t mono_bytes = arena.allocated - parse_bytes - infer_bytes;
+
+    simplify_t simp;
+    simplify_init(&simp, &arena);
+
+    for (size_t i = 0; ok && i < n_decls; i++) {
+        decl_t *decl = decls[i];
+
+        if (!simplify_decl(&simp, decl)) {
+            printf("%s: Failed to simplify\n", path);
+            ok = false;
+            break;
+        }
+
+        if (debug) {
+            printf("Simplified decl: ");
+            decl_println(decl);
+        }
+    }
+
+    size_t simplify_bytes = arena.allocated - parse_bytes - infer_bytes - mono_bytes;
+
+    FILE *out = NULL;
+    if (ok && !driver->run && (out = fopen(obj_path, "wb")) == NULL) {
+        perror(obj_path);
+        ok = false;
+    }
+
+    asm_mode_t mode = driver->run ? ASM_MODE_JIT
+        : driver->emit_asm ? ASM_MODE_TEXT : ASM_MODE_ELF;
+
+    asm_t as;
+    asm_init(&as, &arena, mode, out);
+
     compile_t comp;
-    compile_init(&comp, out);
+    compile_init(&comp, &arena, &as);
+    comp.debug = debug;
 
-    for (size_t i = 0; i < n_decls; i++) {
+    for (size_t i = 0; ok && i < n_decls; i++) {
         decl_t *decl = decls[i];
 
         if (!compile_decl(&comp, decl)) {
-            fputs("Failed to compile ", stdout);
+            printf("%s: Failed to compile ", path);
             decl_println(decl);
-            return 1;
+            ok = false;
         }
     }
 
     // TODO: Fix errors
-    if (!compile_main(&comp)) {
-        printf("Failed to emit main function\n");
-        return 1;
+    if (ok && !compile_main(&comp)) {
+        printf("%s: Failed to emit main function\n", path);
+        ok = false;
+    }
+
+    size_t compile_bytes = arena.allocated - parse_bytes - infer_bytes - mono_bytes
+        - simplify_bytes;
+
+    jit_t jit;
+    if (ok && driver->run && !jit_load(&jit, &as)) {
+        printf("%s: Failed to load code\n", path);
+        ok = false;
+    }
+
+    if (ok && driver->stats) {
+        flockfile(stdout);
+        printf("%s: allocated %zu bytes in %zu chunks\n", path, arena.allocated, arena.n_chunks);
+        printf("  parse:   %zu bytes\n", parse_bytes);
+        printf("  infer:   %zu bytes (%zu scratch)\n", infer_bytes, infer.scratch.allocated);
+        if (driver->mono_budget > 0)
+            printf("  mono:    %zu bytes (%zu scratch), %u copies of %zu nodes\n", mono_bytes,
+                   mono.scratch.allocated, mono.n_specs, mono.n_nodes);
+        printf("  simplify: %zu bytes (%zu scratch)\n", simplify_bytes, simp.scratch.allocated);
+        printf("  compile: %zu bytes (%zu scratch)\n", compile_bytes, comp.scratch.allocated);
+        if (driver->run)
+            printf("  ready to run after %.3f ms\n", unit_elapsed(start));
+        funlockfile(stdout);
+    }
+
+    if (ok && driver->run) {
+        ok = jit_run(&jit) == 0;
+        jit_free(&jit);
     }
 
+    infer_free(&infer);
+    mono_free(&mono);
+    simplify_free(&simp);
     compile_free(&comp);
-    fclose(out);
+    asm_free(&as);
+    if (out != NULL)
+        fclose(out);
+
+    free(decls);
+    arena_free(&arena);
+    return ok;
+}
+
+static bool unit_run(driver_t *driver, const char *path)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
 
-    for (size_t i = 0; i < n_decls; i++)
-        decl_free(decls[i]);
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror(path);
+        close(fd);
+        return false;
+    }
+
+    // Map the file over zeroed pages, so the lexer can read LEX_PADDING
+    // bytes past the end without checking for it
+    size_t size = st.st_size;
+    void *mapped = mmap(NULL, size + LEX_PADDING, PROT_READ,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED || (size > 0 &&
+        mmap(mapped, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+        perror(path);
+        close(fd);
+        return false;
+    }
 
-    puts("Compiling out.S");
+    char *obj_path, *exe_path;
+    unit_outputs(path, driver->emit_asm, &obj_path, &exe_path);
 
-    if (system("gcc out.S -g -fpie") < 0)
-        perror("system");
+    bool ok = unit_compile(driver, path, mapped, size, obj_path, &start);
 
-    munmap(mapped, size);
+    munmap(mapped, size + LEX_PADDING);
     close(fd);
-    return 0;
+
+    if (ok && !driver->run) {
+        printf("Linking %s\n", obj_path);
+        ok = unit_link(obj_path, driver->runtime, exe_path);
+    }
+
+    free(obj_path);
+    free(exe_path);
+    return ok;
+}
+
+// The runtime the executables link against: $NML_RUNTIME, else the path
+// given with -DNML_RUNTIME, else gc.o built next to nmlc
+static char *driver_runtime(void)
+{
+    const char *path = getenv("NML_RUNTIME");
+#ifdef NML_RUNTIME
+    if (path == NULL)
+        path = NML_RUNTIME;
+#endif
+
+    char *runtime;
+    if (path) {
+        runtime = strdup(path);
+    } else {
+        char exe[PATH_MAX];
+        ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        if (len < 0) {
+            perror("readlink");
+            return NULL;
+        }
+        exe[len] = '\0';
+
+        char *slash = strrchr(exe, '/');
+        size_t dir = slash ? slash - exe + 1 : 0;
+
+        runtime = malloc(dir + sizeof("gc.o"));
+        sprintf(runtime, "%.*sgc.o", (int)dir, exe);
+    }
+
+    // Caught before compiling anything rather than when linking
+    if (access(runtime, R_OK) != 0) {
+        printf("Runtime %s not found, set NML_RUNTIME to the path of gc.o\n", runtime);
+        free(runtime);
+        return NULL;
+    }
+    return runtime;
+}
+
+static void *driver_worker(void *arg)
+{
+    driver_t *driver = arg;
+
+    // Files share nothing but the symbol and type tables, so every phase
+    // of a file runs on the worker that picked it up
+    size_t i;
+    while ((i = atomic_fetch_add(&driver->next, 1)) < driver->n_paths) {
+        if (!unit_run(driver, driver->paths[i]))
+            atomic_store(&driver->failed, true);
+    }
+    return NULL;
+}
+
+// Reads the positive number following the flag at *i
+static bool driver_count(int argc, const char **argv, int *i, long *count)
+{
+    if (*i + 1 >= argc)
+        return false;
+
+    const char *arg = argv[++*i];
+    char *end;
+    *count = strtol(arg, &end, 10);
+    return end != arg && *end == '\0' && *count > 0;
+}
+
+int main(int argc, const char **argv)
+{
+    driver_t driver = { 0 };
+    driver.paths = calloc(argc, sizeof(const char *));
+
+    long n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    bool usage = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--debug")) {
+            driver.debug = true;
+        } else if (!strcmp(argv[i], "--stats")) {
+            driver.stats = true;
+        } else if (!strcmp(argv[i], "--emit-asm")) {
+            driver.emit_asm = true;
+        } else if (!strcmp(argv[i], "--run")) {
+            driver.run = true;
+        } else if (!strcmp(argv[i], "--mono")) {
+            long budget = 0;
+            usage |= !driver_count(argc, argv, &i, &budget);
+            driver.mono_budget = budget;
+        } else if (!strcmp(argv[i], "-j")) {
+            usage |= !driver_count(argc, argv, &i, &n_jobs);
+        } else {
+            driver.paths[driver.n_paths++] = argv[i];
+        }
+    }
+
+    if (usage || driver.n_paths == 0) {
+        printf("Usage: %s [--debug] [--stats] [--emit-asm] [--run] [--mono BUDGET] [-j JOBS] PATH...\n", argv[0]);
+        free(driver.paths);
+        return 1;
+    }
+
+    if ((size_t)n_jobs > driver.n_paths)
+        n_jobs = driver.n_paths;
+
+    // Only linking needs the runtime, --run has the collector in nmlc
+    if (!driver.run && (driver.runtime = driver_runtime()) == NULL) {
+        free(driver.paths);
+        return 1;
+    }
+
+    sym_init();
+    type_table_init();
+
+    pthread_t *workers = calloc(n_jobs, sizeof(pthread_t));
+    for (long i = 1; i < n_jobs; i++)
+        pthread_create(&workers[i], NULL, driver_worker, &driver);
+
+    driver_worker(&driver);
+
+    for (long i = 1; i < n_jobs; i++)
+        pthread_join(workers[i], NULL);
+
+    if (driver.stats)
+        printf("Interned %zu symbols\n", sym_count());
+
+    free(workers);
+    free(driver.paths);
+    free(driver.runtime);
+    type_table_free();
+    sym_free();
+
+    return atomic_load(&driver.failed) ? 1 : 0;
 }
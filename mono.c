@@ -0,0 +1,261 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mono.h"
+#include "type.h"
+
+typedef struct mono_spec mono_spec_t;
+
+typedef struct {
+    decl_let_t *decl;
+    // The globals it was defined among, the names free in it are looked
+    // up there
+    env_t *scope;
+    // A polymorphic lambda, which uses at ground types get copies of
+    bool poly;
+    // Polymorphic lambdas and their copies are left out when nothing that
+    // stays uses them
+    bool droppable;
+    bool live;
+    mono_spec_t *specs;
+} mono_global_t;
+
+struct mono_spec {
+    type_t *type;
+    mono_global_t *global;
+    mono_spec_t *next;
+};
+
+void mono_init(mono_t *mono, arena_t *arena, size_t budget)
+{
+    mono->arena = arena;
+    arena_init(&mono->scratch);
+    mono->budget = budget;
+    mono->n_specs = 0;
+    mono->n_nodes = 0;
+    mono->specs = NULL;
+}
+
+static size_t mono_size(expr_t *expr)
+{
+    switch (expr->tag) {
+        case EXPR_LAMBDA:
+            return 1 + mono_size(((expr_lambda_t *)expr)->body);
+
+        case EXPR_APPLY: {
+            expr_apply_t *app = (expr_apply_t *)expr;
+            return 1 + mono_size(app->fun) + mono_size(app->arg);
+        }
+
+        case EXPR_LET: {
+            expr_let_t *let = (expr_let_t *)expr;
+            return 1 + mono_size(let->value) + mono_size(let->body);
+        }
+
+        default:
+            return 1;
+    }
+}
+
+// The global a name refers to, NULL when a local binds it
+static mono_global_t *mono_lookup(mono_t *mono, env_t *scope, env_t *locals, sym_t name)
+{
+    intptr_t global;
+    if (env_find(locals, name, NULL))
+        return NULL;
+    if (env_find(mono->specs, name, &global) || env_find(scope, name, &global))
+        return (mono_global_t *)global;
+    return NULL;
+}
+
+static void mono_scan(mono_t *mono, expr_t *expr, env_t *scope, env_t *locals);
+
+// The copy of global for uses at type, made if the budget allows
+static mono_global_t *mono_specialize(mono_t *mono, mono_global_t *global, type_t *type)
+{
+    for (mono_spec_t *spec = global->specs; spec; spec = spec->next) {
+        if (spec->type == type)
+            return spec->global;
+    }
+
+    decl_let_t *decl = global->decl;
+    size_t size = mono_size(decl->value);
+    if (size > mono->budget)
+        return NULL;
+
+    type_t **types = arena_alloc(&mono->scratch, decl->scheme.n_vars * sizeof(type_t *));
+    if (!type_scheme_match(&decl->scheme, type, types))
+        return NULL;
+
+    mono->budget -= size;
+    mono->n_nodes += size;
+
+    // Source names cannot have an @ in them
+    char name[64];
+    int len = snprintf(name, sizeof(name), "%.40s@%u", sym_name(decl->bound), mono->n_specs++);
+
+    expr_t *copy = expr_copy(mono->arena, decl->value, &decl->scheme, types);
+    decl_let_t *spec_decl = (decl_let_t *)decl_let_new(mono->arena, sym_intern(name, len), copy);
+    type_scheme_init(mono->arena, &spec_decl->scheme, type, 0, NULL);
+
+    mono_global_t *spec_global = arena_calloc(&mono->scratch, 1, sizeof(mono_global_t));
+    spec_global->decl = spec_decl;
+    spec_global->scope = global->scope;
+    spec_global->droppable = true;
+
+    mono_spec_t *spec = arena_alloc(&mono->scratch, sizeof(mono_spec_t));
+    spec->type = type;
+    spec->global = spec_global;
+    spec->next = global->specs;
+    global->specs = spec;
+
+    mono->specs = env_update(&mono->scratch, mono->specs, spec_decl->bound, (intptr_t)spec_global);
+
+    // The copy has ground types where the original had variables, so it
+    // may have uses to specialize in turn
+    mono_scan(mono, copy, global->scope, NULL);
+    return spec_global;
+}
+
+// Points the uses in expr of polymorphic lambdas at ground types to their
+// copies
+static void mono_scan(mono_t *mono, expr_t *expr, env_t *scope, env_t *locals)
+{
+    switch (expr->tag) {
+        case EXPR_LIT:
+            break;
+
+        case EXPR_VAR: {
+            expr_var_t *var = (expr_var_t *)expr;
+            mono_global_t *global = mono_lookup(mono, scope, locals, var->name);
+            if (!global || !global->poly || !expr->type || !expr->type->ground)
+                break;
+
+            mono_global_t *spec = mono_specialize(mono, global, expr->type);
+            if (spec)
+                var->name = spec->decl->bound;
+            break;
+        }
+
+        case EXPR_LAMBDA: {
+            expr_lambda_t *lam = (expr_lambda_t *)expr;
+            locals = env_append(&mono->scratch, locals, lam->bound, 0);
+            mono_scan(mono, lam->body, scope, locals);
+            break;
+        }
+
+        case EXPR_APPLY: {
+            expr_apply_t *app = (expr_apply_t *)expr;
+            mono_scan(mono, app->fun, scope, locals);
+            mono_scan(mono, app->arg, scope, locals);
+            break;
+        }
+
+        case EXPR_LET: {
+            expr_let_t *let = (expr_let_t *)expr;
+            mono_scan(mono, let->value, scope, locals);
+            locals = env_append(&mono->scratch, locals, let->bound, 0);
+            mono_scan(mono, let->body, scope, locals);
+            break;
+        }
+    }
+}
+
+// Marks the droppable globals that expr uses, and the ones they use
+static void mono_mark(mono_t *mono, expr_t *expr, env_t *scope, env_t *locals)
+{
+    switch (expr->tag) {
+        case EXPR_LIT:
+            break;
+
+        case EXPR_VAR: {
+            mono_global_t *global = mono_lookup(mono, scope, locals, ((expr_var_t *)expr)->name);
+            if (global && global->droppable && !global->live) {
+                global->live = true;
+                mono_mark(mono, global->decl->value, global->scope, NULL);
+            }
+            break;
+        }
+
+        case EXPR_LAMBDA: {
+            expr_lambda_t *lam = (expr_lambda_t *)expr;
+            locals = env_append(&mono->scratch, locals, lam->bound, 0);
+            mono_mark(mono, lam->body, scope, locals);
+            break;
+        }
+
+        case EXPR_APPLY: {
+            expr_apply_t *app = (expr_apply_t *)expr;
+            mono_mark(mono, app->fun, scope, locals);
+            mono_mark(mono, app->arg, scope, locals);
+            break;
+        }
+
+        case EXPR_LET: {
+            expr_let_t *let = (expr_let_t *)expr;
+            mono_mark(mono, let->value, scope, locals);
+            locals = env_append(&mono->scratch, locals, let->bound, 0);
+            mono_mark(mono, let->body, scope, locals);
+            break;
+        }
+    }
+}
+
+bool mono_program(mono_t *mono, decl_t ***decls, size_t *n_decls)
+{
+    size_t n = *n_decls;
+    mono_global_t **globals = arena_alloc(&mono->scratch, n * sizeof(mono_global_t *));
+    env_t *scope = NULL;
+
+    for (size_t i = 0; i < n; i++) {
+        if ((*decls)[i]->tag != DECL_LET)
+            return false;
+
+        decl_let_t *let = (decl_let_t *)(*decls)[i];
+        mono_global_t *global = arena_calloc(&mono->scratch, 1, sizeof(mono_global_t));
+        global->decl = let;
+        global->scope = scope;
+        global->poly = let->scheme.n_vars > 0 && let->value->tag == EXPR_LAMBDA;
+        global->droppable = global->poly;
+
+        globals[i] = global;
+        scope = env_update(&mono->scratch, scope, let->bound, (intptr_t)global);
+    }
+
+    for (size_t i = 0; i < n; i++)
+        mono_scan(mono, globals[i]->decl->value, globals[i]->scope, NULL);
+
+    for (size_t i = 0; i < n; i++) {
+        if (!globals[i]->droppable)
+            mono_mark(mono, globals[i]->decl->value, globals[i]->scope, NULL);
+    }
+
+    // Copies go right after the lambda they are of, where the names free
+    // in them mean the same
+    size_t n_out = 0;
+    decl_t **out = malloc((n + mono->n_specs) * sizeof(decl_t *));
+
+    for (size_t i = 0; i < n; i++) {
+        mono_global_t *global = globals[i];
+        if (!global->droppable || global->live)
+            out[n_out++] = (decl_t *)global->decl;
+
+        for (mono_spec_t *spec = global->specs; spec; spec = spec->next) {
+            if (spec->global->live)
+                out[n_out++] = (decl_t *)spec->global->decl;
+        }
+    }
+
+    free(*decls);
+    *decls = out;
+    *n_decls = n_out;
+    return true;
+}
+
+void mono_free(mono_t *mono)
+{
+    arena_free(&mono->scratch);
+}
@@ -0,0 +1,35 @@
+#ifndef MONO_H
+#define MONO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "decl.h"
+#include "env.h"
+
+// Whole-program monomorphization: every use of a polymorphic global lambda
+// at a ground type gets a copy of it specialized to that type, declared
+// right after it, for as long as the copies fit in the budget. Runs on
+// typed declarations, before they are simplified.
+typedef struct {
+    arena_t *arena;
+    arena_t scratch;
+    // AST nodes the copies may still add
+    size_t budget;
+    uint32_t n_specs;
+    size_t n_nodes;
+    // Name of a copy to its mono_global_t
+    env_t *specs;
+} mono_t;
+
+void mono_init(mono_t *mono, arena_t *arena, size_t budget);
+
+// Rewrites the program in decls, which is reallocated to hold the copies.
+// Polymorphic lambdas that no longer have any use are dropped.
+bool mono_program(mono_t *mono, decl_t ***decls, size_t *n_decls);
+
+void mono_free(mono_t *mono);
+
+#endif
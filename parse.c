@@ -24,8 +24,9 @@ static void parse_next(parse_t *parse)
     }
 }
 
-void parse_init(parse_t *parse, const char *src, size_t len)
+void parse_init(parse_t *parse, arena_t *arena, const char *src, size_t len)
 {
+    parse->arena = arena;
     lex_init(&parse->lex, src, len);
     parse_next(parse);
 }
@@ -84,18 +85,19 @@ static bool parse_type(parse_t *parse, type_t **type);
 static bool parse_type_simple(parse_t *parse, type_t **type)
 {
     if (parse_check(parse, TOK_IDENT)) {
-        char *var = strndup(parse->next.str, parse->next.len);
+        sym_t var = parse->next.sym;
+        bool lower = islower(*parse->next.str);
         parse_next(parse);
 
-        *type = islower(var[0])
-              ? type_var_new(var, 0)
-              : type_con_new(var, 0, NULL);
+        *type = lower
+              ? type_var_new(parse->arena, var, 0)
+              : type_con_new(parse->arena, var, 0, NULL);
         return true;
     }
 
     if (parse_match(parse, TOK_LPAR)) {
         if (parse_match(parse, TOK_RPAR)) {
-            *type = type_con_new(strdup("()"), 0, NULL);
+            *type = type_con_new(parse->arena, SYM_UNIT, 0, NULL);
             return true;
         }
 
@@ -110,19 +112,22 @@ static bool parse_type_simple(parse_t *parse, type_t **type)
 static bool parse_type(parse_t *parse, type_t **type)
 {
     if (parse_check(parse, TOK_IDENT) && isupper(*parse->next.str)) {
-        char *name = strndup(parse->next.str, parse->next.len);
+        sym_t name = parse->next.sym;
         parse_next(parse);
 
         type_t **args = NULL;
         size_t n_args = 0;
 
         while (!parse_check_delim(parse)) {
-            args = realloc(args, ++n_args * sizeof(type_t *));
+            args = arena_realloc(parse->arena, args,
+                                 n_args * sizeof(type_t *),
+                                 (n_args + 1) * sizeof(type_t *));
+            n_args++;
             if (!parse_type_simple(parse, &args[n_args - 1]))
                 return false;
         }
 
-        *type = type_con_new(name, n_args, args);
+        *type = type_con_new(parse->arena, name, n_args, args);
     } else if (!parse_type_simple(parse, type))
         return false;
 
@@ -131,7 +136,7 @@ static bool parse_type(parse_t *parse, type_t **type)
         if (!parse_type(parse, &rhs))
             return false;
 
-        *type = type_con_new_v(strdup("->"), 2, *type, rhs);
+        *type = type_con_new_v(parse->arena, SYM_ARROW, 2, *type, rhs);
     }
 
     return true;
@@ -152,8 +157,7 @@ static bool parse_expr_lambda(parse_t *parse, expr_t **expr)
     if (!parse_expr(parse, &body))
         return false;
 
-    char *bound = strndup(var.str, var.len);
-    *expr = expr_lambda_new(bound, body);
+    *expr = expr_lambda_new(parse->arena, var.sym, body);
     return true;
 }
 
@@ -177,8 +181,7 @@ static bool parse_expr_let(parse_t *parse, expr_t **expr)
     if (!parse_expr(parse, &body))
         return false;
 
-    char *bound = strndup(var.str, var.len);
-    *expr = expr_let_new(bound, value, body);
+    *expr = expr_let_new(parse->arena, var.sym, value, body);
     return true;
 }
 
@@ -186,22 +189,21 @@ static bool parse_expr_simple(parse_t *parse, expr_t **expr)
 {
     switch (parse->next.type) {
         case TOK_IDENT: {
-            char *var = strndup(parse->next.str, parse->next.len);
-            *expr = expr_var_new(var);
+            *expr = expr_var_new(parse->arena, parse->next.sym);
             parse_next(parse);
             return true;
         }
 
         case TOK_NUMBER: {
             int64_t value = strtoll(parse->next.str, NULL, 10);
-            *expr = expr_lit_new_int(value);
+            *expr = expr_lit_new_int(parse->arena, value);
             parse_next(parse);
             return true;
         }
 
         case TOK_STRING: {
-            char *str = strndup(parse->next.str + 1, parse->next.len - 2);
-            *expr = expr_lit_new_str(str);
+            char *str = arena_strndup(parse->arena, parse->next.str + 1, parse->next.len - 2);
+            *expr = expr_lit_new_str(parse->arena, str);
             parse_next(parse);
             return true;
         }
@@ -213,7 +215,7 @@ static bool parse_expr_simple(parse_t *parse, expr_t **expr)
         case TOK_LPAR:
             parse_next(parse);
             if (parse_match(parse, TOK_RPAR)) {
-                *expr = expr_lit_new_unit();
+                *expr = expr_lit_new_unit(parse->arena);
                 return true;
             }
 
@@ -247,7 +249,7 @@ static bool parse_expr(parse_t *parse, expr_t **expr)
         if (!parse_expr_simple(parse, &arg))
             return false;
 
-        *expr = expr_apply_new(*expr, arg);
+        *expr = expr_apply_new(parse->arena, *expr, arg);
     }
     return true;
 }
@@ -274,8 +276,7 @@ static bool parse_decl_let(parse_t *parse, decl_t **decl)
     if (!parse_expect(parse, TOK_SEMI))
         return false;
 
-    char *bound = strndup(var.str, var.len);
-    *decl = decl_let_new(bound, value);
+    *decl = decl_let_new(parse->arena, var.sym, value);
     ((decl_let_t *)*decl)->scheme.type = annot;
     return true;
 }
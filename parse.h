@@ -1,15 +1,17 @@
 #ifndef PARSE_H
 #define PARSE_H
 
+#include "arena.h"
 #include "decl.h"
 #include "lex.h"
 
 typedef struct {
     lex_t lex;
     token_t next;
+    arena_t *arena;
 } parse_t;
 
-void parse_init(parse_t *parse, const char *src, size_t len);
+void parse_init(parse_t *parse, arena_t *arena, const char *src, size_t len);
 
 bool parse_eof(parse_t *parse);
 
@@ -0,0 +1,191 @@
+#include <stdint.h>
+
+#include "asm.h"
+#include "regalloc.h"
+
+#define REGALLOC_CALLER_SAVED \
+    (1u << ASM_RAX | 1u << ASM_RCX | 1u << ASM_RDX | 1u << ASM_RSI | \
+     1u << ASM_RDI | 1u << ASM_R8 | 1u << ASM_R9)
+
+#define REGALLOC_NO_HINT 0xFF
+
+#define REGALLOC_CALLEE_SAVED \
+    (1u << ASM_RBX | 1u << ASM_R12 | 1u << ASM_R13 | 1u << ASM_R14 | 1u << ASM_R15)
+
+const asm_reg_t regalloc_args[IR_MAX_ARGS] = {
+    ASM_RDI, ASM_RSI, ASM_RDX, ASM_RCX, ASM_R8, ASM_R9,
+};
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    bool across_call;
+    uint8_t hint;
+} regalloc_interval_t;
+
+static bool regalloc_is_call(ir_inst_t *inst)
+{
+    return inst->op == IR_CALL || inst->op == IR_CALL_SYM || inst->op == IR_CALL_C;
+}
+
+static void regalloc_use(ir_func_t *func, regalloc_interval_t *intervals,
+                         ir_reg_t reg, uint32_t index)
+{
+    if (reg == IR_NONE)
+        return;
+
+    func->locs[reg].used = true;
+    if (intervals[reg].end < index)
+        intervals[reg].end = index;
+}
+
+static void regalloc_hint(regalloc_interval_t *intervals, ir_reg_t reg, asm_reg_t hint)
+{
+    if (reg != IR_NONE && intervals[reg].hint == REGALLOC_NO_HINT)
+        intervals[reg].hint = hint;
+}
+
+// Values that are only defined where the calling convention wants them
+// need no moves
+static void regalloc_hints(ir_inst_t *inst, regalloc_interval_t *intervals)
+{
+    switch (inst->op) {
+        case IR_PARAM:
+            regalloc_hint(intervals, inst->dst, regalloc_args[inst->imm]);
+            break;
+
+        case IR_CALL:
+        case IR_CALL_SYM:
+        case IR_CALL_C:
+            regalloc_hint(intervals, inst->dst, ASM_RAX);
+            for (uint32_t i = 0; i < inst->n_args; i++)
+                regalloc_hint(intervals, inst->args[i], regalloc_args[i]);
+            break;
+
+        case IR_RET:
+            regalloc_hint(intervals, inst->a, ASM_RAX);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void regalloc_spill(ir_func_t *func, ir_reg_t reg)
+{
+    func->locs[reg].spilled = true;
+    func->locs[reg].slot = func->n_slots++;
+}
+
+void regalloc_func(ir_func_t *func)
+{
+    arena_t *arena = func->arena;
+    regalloc_interval_t *intervals = arena_calloc(arena, func->n_regs, sizeof(regalloc_interval_t));
+    uint32_t *calls = arena_calloc(arena, func->n_insts + 1, sizeof(uint32_t));
+
+    func->locs = arena_calloc(arena, func->n_regs, sizeof(ir_loc_t));
+    func->n_slots = 0;
+    func->saved = 0;
+
+    for (ir_reg_t reg = 0; reg < func->n_regs; reg++)
+        intervals[reg].hint = REGALLOC_NO_HINT;
+
+    // Code is straight-line, so an interval runs from the definition to
+    // the last use
+    for (uint32_t i = 0; i < func->n_insts; i++) {
+        ir_inst_t *inst = &func->insts[i];
+
+        regalloc_use(func, intervals, inst->a, i);
+        regalloc_use(func, intervals, inst->b, i);
+        for (uint32_t j = 0; j < inst->n_args; j++)
+            regalloc_use(func, intervals, inst->args[j], i);
+        if (inst->dst != IR_NONE)
+            intervals[inst->dst].start = intervals[inst->dst].end = i;
+
+        regalloc_hints(inst, intervals);
+
+        calls[i + 1] = calls[i] + regalloc_is_call(inst);
+    }
+
+    // The nursery's slow path calls out but keeps every register, and tail
+    // calls leave with the stack as it was on entry
+    func->calls = false;
+    for (uint32_t i = 0; i < func->n_insts && !func->calls; i++) {
+        ir_inst_t *inst = &func->insts[i];
+        func->calls = (regalloc_is_call(inst) && !inst->tail) || inst->op == IR_ALLOC;
+    }
+
+    // Values live across a call can only sit in callee-saved registers
+    for (ir_reg_t reg = 0; reg < func->n_regs; reg++) {
+        regalloc_interval_t *interval = &intervals[reg];
+        interval->across_call = interval->end > interval->start + 1
+            && calls[interval->end] - calls[interval->start + 1] > 0;
+    }
+
+    ir_reg_t *active = arena_alloc(arena, func->n_regs * sizeof(ir_reg_t));
+    size_t n_active = 0;
+    uint32_t unused = REGALLOC_CALLER_SAVED | REGALLOC_CALLEE_SAVED;
+
+    // Registers are defined in order, so they are already sorted by start
+    for (ir_reg_t reg = 0; reg < func->n_regs; reg++) {
+        regalloc_interval_t *interval = &intervals[reg];
+
+        // Unused values are never emitted
+        if (!func->locs[reg].used)
+            continue;
+
+        // Operands are read before the result is written, so a register
+        // whose last use defines this one can be reused right away
+        for (size_t i = 0; i < n_active; ) {
+            if (intervals[active[i]].end <= interval->start) {
+                unused |= 1u << func->locs[active[i]].reg;
+                active[i] = active[--n_active];
+            } else {
+                i++;
+            }
+        }
+
+        uint32_t allowed = REGALLOC_CALLEE_SAVED;
+        if (!interval->across_call)
+            allowed |= REGALLOC_CALLER_SAVED;
+
+        // Prefer the hint, then caller-saved registers as they need no
+        // saving
+        uint32_t avail = unused & allowed;
+        if (interval->hint != REGALLOC_NO_HINT && avail & 1u << interval->hint)
+            avail = 1u << interval->hint;
+        else if (avail & REGALLOC_CALLER_SAVED)
+            avail &= REGALLOC_CALLER_SAVED;
+
+        if (avail) {
+            uint8_t phys = __builtin_ctz(avail);
+            unused &= ~(1u << phys);
+            func->locs[reg].reg = phys;
+            active[n_active++] = reg;
+            continue;
+        }
+
+        // Otherwise spill whichever interval ends last
+        size_t victim = n_active;
+        for (size_t i = 0; i < n_active; i++) {
+            if (!(allowed & 1u << func->locs[active[i]].reg))
+                continue;
+            if (victim == n_active || intervals[active[i]].end > intervals[active[victim]].end)
+                victim = i;
+        }
+
+        if (victim != n_active && intervals[active[victim]].end > interval->end) {
+            func->locs[reg].reg = func->locs[active[victim]].reg;
+            regalloc_spill(func, active[victim]);
+            active[victim] = reg;
+        } else {
+            regalloc_spill(func, reg);
+        }
+    }
+
+    for (ir_reg_t reg = 0; reg < func->n_regs; reg++) {
+        ir_loc_t *loc = &func->locs[reg];
+        if (loc->used && !loc->spilled && REGALLOC_CALLEE_SAVED & 1u << loc->reg)
+            func->saved |= 1u << func->locs[reg].reg;
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include "asm.h"
+#include "ir.h"
+
+// Registers the allocator never hands out, scratch for spilled operands
+// and for breaking cycles between argument moves
+#define REGALLOC_SCRATCH_A ASM_R10
+#define REGALLOC_SCRATCH_B ASM_R11
+
+// Where calls pass their arguments, the closure of a lambda first
+extern const asm_reg_t regalloc_args[IR_MAX_ARGS];
+
+// Linear scan over the live intervals of func, filling in func->locs
+void regalloc_func(ir_func_t *func);
+
+#endif
@@ -0,0 +1,446 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "simplify.h"
+#include "type.h"
+
+// Lambdas with a body of at most this many nodes are copied into every
+// call
+#define SIMPLIFY_INLINE_SIZE 16
+// Rounds of counting uses then rewriting, each cleans up after the last
+#define SIMPLIFY_PASSES 4
+// Copies may grow a declaration by this many times its size
+#define SIMPLIFY_GROWTH 2
+
+// Uses of a let-bound name, counted before each round
+typedef struct {
+    uint32_t uses;
+    uint32_t calls;
+} simplify_occ_t;
+
+// A global lambda that later declarations can have copies of
+typedef struct {
+    expr_lambda_t *lam;
+    type_scheme_t *scheme;
+    // The globals it was defined among, the names free in it have to
+    // mean the same where it is copied
+    env_t *scope;
+    env_t *free;
+} simplify_global_t;
+
+void simplify_init(simplify_t *simp, arena_t *arena)
+{
+    simp->arena = arena;
+    arena_init(&simp->scratch);
+    simp->fresh = 0;
+    simp->globals = NULL;
+    simp->inline_globals = NULL;
+    simp->occs = NULL;
+    simp->subst = NULL;
+    simp->budget = 0;
+    simp->changed = false;
+}
+
+// A name for a local binder that no other binder in the unit has, dots
+// cannot appear in source names
+static sym_t simplify_fresh(simplify_t *simp, sym_t name)
+{
+    const char *str = sym_name(name);
+    const char *dot = strchr(str, '.');
+    int len = dot ? dot - str : (int)strlen(str);
+
+    char buf[64];
+    len = snprintf(buf, sizeof(buf), "%.*s.%u", len < 40 ? len : 40, str, simp->fresh++);
+    return sym_intern(buf, len);
+}
+
+// Gives every local binder its own name, so nothing the rewrites move
+// around can be captured
+static void simplify_rename(simplify_t *simp, expr_t *expr, env_t *names)
+{
+    switch (expr->tag) {
+        case EXPR_LIT:
+            break;
+
+        case EXPR_VAR: {
+            expr_var_t *var = (expr_var_t *)expr;
+            intptr_t name;
+            if (env_find(names, var->name, &name))
+                var->name = name;
+            break;
+        }
+
+        case EXPR_LAMBDA: {
+            expr_lambda_t *lam = (expr_lambda_t *)expr;
+            sym_t name = simplify_fresh(simp, lam->bound);
+            names = env_append(&simp->scratch, names, lam->bound, name);
+            lam->bound = name;
+            simplify_rename(simp, lam->body, names);
+            break;
+        }
+
+        case EXPR_APPLY: {
+            expr_apply_t *app = (expr_apply_t *)expr;
+            simplify_rename(simp, app->fun, names);
+            simplify_rename(simp, app->arg, names);
+            break;
+        }
+
+        case EXPR_LET: {
+            expr_let_t *let = (expr_let_t *)expr;
+            simplify_rename(simp, let->value, names);
+
+            sym_t name = simplify_fresh(simp, let->bound);
+            names = env_append(&simp->scratch, names, let->bound, name);
+            let->bound = name;
+            simplify_rename(simp, let->body, names);
+            break;
+        }
+    }
+}
+
+// Whether expr has at most *left nodes, taking them off *left
+static bool simplify_fits(expr_t *expr, size_t *left)
+{
+    if (*left == 0)
+        return false;
+    (*left)--;
+
+    switch (expr->tag) {
+        case EXPR_LAMBDA:
+            return simplify_fits(((expr_lambda_t *)expr)->body, left);
+
+        case EXPR_APPLY: {
+            expr_apply_t *app = (expr_apply_t *)expr;
+            return simplify_fits(app->fun, left) && simplify_fits(app->arg, left);
+        }
+
+        case EXPR_LET: {
+            expr_let_t *let = (expr_let_t *)expr;
+            return simplify_fits(let->value, left) && simplify_fits(let->body, left);
+        }
+
+        default:
+            return true;
+    }
+}
+
+static simplify_occ_t *simplify_occ(simplify_t *simp, sym_t name)
+{
+    intptr_t occ;
+    return env_find(simp->occs, name, &occ) ? (simplify_occ_t *)occ : NULL;
+}
+
+// Counts the uses of the names let-bound in expr, call is set for the
+// function of an application
+static void simplify_count(simplify_t *simp, expr_t *expr, bool call)
+{
+    switch (expr->tag) {
+        case EXPR_LIT:
+            break;
+
+        case EXPR_VAR: {
+            simplify_occ_t *occ = simplify_occ(simp, ((expr_var_t *)expr)->name);
+            if (occ) {
+                occ->uses++;
+                occ->calls += call;
+            }
+            break;
+        }
+
+        case EXPR_LAMBDA:
+            simplify_count(simp, ((expr_lambda_t *)expr)->body, false);
+            break;
+
+        case EXPR_APPLY: {
+            expr_apply_t *app = (expr_apply_t *)expr;
+            simplify_count(simp, app->fun, true);
+            simplify_count(simp, app->arg, false);
+            break;
+        }
+
+        case EXPR_LET: {
+            expr_let_t *let = (expr_let_t *)expr;
+            simplify_occ_t *occ = arena_calloc(&simp->scratch, 1, sizeof(simplify_occ_t));
+            simp->occs = env_update(&simp->scratch, simp->occs, let->bound, (intptr_t)occ);
+
+            simplify_count(simp, let->value, false);
+            simplify_count(simp, let->body, false);
+            break;
+        }
+    }
+}
+
+// A copy of expr typed for the instance of scheme given by types, with
+// fresh binders
+static expr_t *simplify_copy(simplify_t *simp, expr_t *expr, type_scheme_t *scheme, type_t **types)
+{
+    expr_t *copy = expr_copy(simp->arena, expr, scheme, types);
+    simplify_rename(simp, copy, NULL);
+    return copy;
+}
+
+// Whether the names free in a global lambda still mean what they did
+static bool simplify_global_valid(simplify_t *simp, simplify_global_t *global)
+{
+    env_iter_t iter;
+    env_iter_init(&iter, global->free);
+
+    sym_t name;
+    intptr_t unused;
+    while (env_iter_next(&iter, &name, &unused)) {
+        intptr_t then = 0, now = 0;
+        if (env_find(global->scope, name, &then) != env_find(simp->globals, name, &now)
+            || then != now)
+            return false;
+    }
+    return true;
+}
+
+// A copy of the lambda the function of a call stands for, typed for this
+// use, or NULL when it is not to be inlined here
+static expr_t *simplify_callee(simplify_t *simp, expr_var_t *fun)
+{
+    expr_lambda_t *lam;
+    type_scheme_t *scheme;
+    bool single = false;
+
+    intptr_t found;
+    if (env_find(simp->subst, fun->name, &found)) {
+        expr_let_t *let = (expr_let_t *)found;
+        if (let->value->tag != EXPR_LAMBDA)
+            return NULL;
+
+        lam = (expr_lambda_t *)let->value;
+        scheme = &let->scheme;
+
+        simplify_occ_t *occ = simplify_occ(simp, let->bound);
+        single = occ && occ->uses == 1;
+    } else if (env_find(simp->inline_globals, fun->name, &found)) {
+        simplify_global_t *global = (simplify_global_t *)found;
+        if (!simplify_global_valid(simp, global))
+            return NULL;
+
+        lam = global->lam;
+        scheme = global->scheme;
+    } else {
+        return NULL;
+    }
+
+    // A lambda used once only moves, copies of others come out of the
+    // budget
+    size_t left = SIMPLIFY_INLINE_SIZE + 1;
+    simplify_fits((expr_t *)lam, &left);
+    size_t size = SIMPLIFY_INLINE_SIZE + 1 - left;
+    if (!single && size > simp->budget)
+        return NULL;
+
+    type_t **types = arena_alloc(&simp->scratch, scheme->n_vars * sizeof(type_t *));
+    if (!type_scheme_match(scheme, fun->base.type, types))
+        return NULL;
+
+    if (!single)
+        simp->budget -= size;
+    return simplify_copy(simp, (expr_t *)lam, scheme, types);
+}
+
+static expr_t *simplify_expr(simplify_t *simp, expr_t *expr);
+
+static expr_t *simplify_let(simplify_t *simp, expr_let_t *let)
+{
+    expr_t *value = let->value;
+    simplify_occ_t *occ = simplify_occ(simp, let->bound);
+
+    // Only applications can have effects, other unused values go
+    if (occ && occ->uses == 0 && value->tag != EXPR_APPLY && value->tag != EXPR_LET) {
+        simp->changed = true;
+        return simplify_expr(simp, let->body);
+    }
+
+    // Names and literals take the place of the name bound to them
+    if (value->tag == EXPR_LIT || value->tag == EXPR_VAR) {
+        simp->subst = env_update(&simp->scratch, simp->subst, let->bound, (intptr_t)let);
+        simp->changed = true;
+        return simplify_expr(simp, let->body);
+    }
+
+    // Lambdas are copied into their calls, and the let goes in the next
+    // round once nothing uses it
+    if (value->tag == EXPR_LAMBDA && occ && occ->calls > 0) {
+        size_t left = SIMPLIFY_INLINE_SIZE;
+        if (occ->uses == 1 || simplify_fits(((expr_lambda_t *)value)->body, &left))
+            simp->subst = env_update(&simp->scratch, simp->subst, let->bound, (intptr_t)let);
+    }
+
+    let->body = simplify_expr(simp, let->body);
+    return (expr_t *)let;
+}
+
+static expr_t *simplify_apply(simplify_t *simp, expr_apply_t *app)
+{
+    app->arg = simplify_expr(simp, app->arg);
+
+    expr_t *fun = NULL;
+    if (app->fun->tag == EXPR_VAR)
+        fun = simplify_callee(simp, (expr_var_t *)app->fun);
+    app->fun = fun ? fun : simplify_expr(simp, app->fun);
+
+    if (app->fun->tag != EXPR_LAMBDA)
+        return (expr_t *)app;
+
+    // (\x -> body) arg is let x = arg in body, the lambda has no effects
+    // to order before arg
+    expr_lambda_t *lam = (expr_lambda_t *)app->fun;
+    expr_let_t *let = (expr_let_t *)expr_let_new(simp->arena, lam->bound, app->arg, lam->body);
+    type_scheme_init(simp->arena, &let->scheme, app->arg->type, 0, NULL);
+    expr_annotate((expr_t *)let, app->base.type);
+
+    simplify_occ_t *occ = arena_calloc(&simp->scratch, 1, sizeof(simplify_occ_t));
+    simp->occs = env_update(&simp->scratch, simp->occs, let->bound, (intptr_t)occ);
+    simplify_count(simp, let->body, false);
+
+    simp->changed = true;
+    return simplify_let(simp, let);
+}
+
+static expr_t *simplify_expr(simplify_t *simp, expr_t *expr)
+{
+    switch (expr->tag) {
+        case EXPR_LIT:
+            return expr;
+
+        case EXPR_VAR: {
+            expr_var_t *var = (expr_var_t *)expr;
+            intptr_t found;
+            if (!env_find(simp->subst, var->name, &found))
+                return expr;
+
+            // Lambdas are only copied into calls
+            expr_t *value = ((expr_let_t *)found)->value;
+            if (value->tag == EXPR_LAMBDA)
+                return expr;
+
+            return expr_annotate(simplify_copy(simp, value, NULL, NULL), expr->type);
+        }
+
+        case EXPR_LAMBDA: {
+            expr_lambda_t *lam = (expr_lambda_t *)expr;
+            lam->body = simplify_expr(simp, lam->body);
+            return expr;
+        }
+
+        case EXPR_APPLY:
+            return simplify_apply(simp, (expr_apply_t *)expr);
+
+        case EXPR_LET: {
+            expr_let_t *let = (expr_let_t *)expr;
+            let->value = simplify_expr(simp, let->value);
+            return simplify_let(simp, let);
+        }
+    }
+    return expr;
+}
+
+// Names used in expr and not bound in it
+static env_t *simplify_free_names(simplify_t *simp, expr_t *expr, env_t *free)
+{
+    switch (expr->tag) {
+        case EXPR_LIT:
+            return free;
+
+        case EXPR_VAR:
+            return env_update(simp->arena, free, ((expr_var_t *)expr)->name, 0);
+
+        case EXPR_LAMBDA: {
+            expr_lambda_t *lam = (expr_lambda_t *)expr;
+            return env_remove(simp->arena, simplify_free_names(simp, lam->body, free), lam->bound);
+        }
+
+        case EXPR_APPLY: {
+            expr_apply_t *app = (expr_apply_t *)expr;
+            return simplify_free_names(simp, app->arg, simplify_free_names(simp, app->fun, free));
+        }
+
+        case EXPR_LET: {
+            expr_let_t *let = (expr_let_t *)expr;
+            free = env_remove(simp->arena, simplify_free_names(simp, let->body, free), let->bound);
+            return simplify_free_names(simp, let->value, free);
+        }
+    }
+    return free;
+}
+
+// Makes the global bound by let available to later declarations when it
+// is a small lambda, or another name for one
+static void simplify_export(simplify_t *simp, decl_let_t *let, env_t *scope)
+{
+    simplify_global_t *global = NULL;
+    intptr_t found;
+
+    if (let->value->tag == EXPR_LAMBDA) {
+        expr_lambda_t *lam = (expr_lambda_t *)let->value;
+        size_t left = SIMPLIFY_INLINE_SIZE;
+
+        if (simplify_fits(lam->body, &left)) {
+            global = arena_alloc(simp->arena, sizeof(simplify_global_t));
+            global->lam = lam;
+            global->scheme = &let->scheme;
+            global->scope = scope;
+            global->free = simplify_free_names(simp, let->value, NULL);
+        }
+    } else if (let->value->tag == EXPR_VAR
+               && env_find(simp->inline_globals, ((expr_var_t *)let->value)->name, &found)
+               && simplify_global_valid(simp, (simplify_global_t *)found)) {
+        global = (simplify_global_t *)found;
+    }
+
+    if (global)
+        simp->inline_globals = env_update(simp->arena, simp->inline_globals, let->bound, (intptr_t)global);
+    else
+        simp->inline_globals = env_remove(simp->arena, simp->inline_globals, let->bound);
+}
+
+bool simplify_decl(simplify_t *simp, decl_t *decl)
+{
+    if (decl->tag != DECL_LET)
+        return false;
+
+    decl_let_t *let = (decl_let_t *)decl;
+    arena_mark_t mark = arena_save(&simp->scratch);
+
+    simplify_rename(simp, let->value, NULL);
+
+    size_t left = SIZE_MAX;
+    simplify_fits(let->value, &left);
+    simp->budget = SIMPLIFY_GROWTH * (SIZE_MAX - left + SIMPLIFY_INLINE_SIZE);
+
+    for (int pass = 0; pass < SIMPLIFY_PASSES; pass++) {
+        arena_mark_t round = arena_save(&simp->scratch);
+        simp->occs = NULL;
+        simp->subst = NULL;
+        simp->changed = false;
+
+        simplify_count(simp, let->value, false);
+        let->value = simplify_expr(simp, let->value);
+
+        arena_restore(&simp->scratch, round);
+        if (!simp->changed)
+            break;
+    }
+
+    simp->occs = NULL;
+    simp->subst = NULL;
+    arena_restore(&simp->scratch, mark);
+
+    env_t *scope = simp->globals;
+    simp->globals = env_update(simp->arena, simp->globals, let->bound, (intptr_t)let);
+    simplify_export(simp, let, scope);
+    return true;
+}
+
+void simplify_free(simplify_t *simp)
+{
+    arena_free(&simp->scratch);
+}
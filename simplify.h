@@ -0,0 +1,37 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "decl.h"
+#include "env.h"
+#include "expr.h"
+
+// Rewrites typed declarations before they are compiled: beta reduction,
+// inlining of small and single-use lambdas, trivial and dead lets. Types
+// are kept on every node, so it runs after infer_decl.
+typedef struct {
+    arena_t *arena;
+    arena_t scratch;
+    uint32_t fresh;
+    // Global name to its decl_let_t, for the ones defined so far
+    env_t *globals;
+    // Global name to a simplify_global_t, for the ones worth inlining
+    env_t *inline_globals;
+
+    // Per declaration, in scratch
+    env_t *occs;
+    env_t *subst;
+    size_t budget;
+    bool changed;
+} simplify_t;
+
+void simplify_init(simplify_t *simp, arena_t *arena);
+
+bool simplify_decl(simplify_t *simp, decl_t *decl);
+
+void simplify_free(simplify_t *simp);
+
+#endif
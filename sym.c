@@ -0,0 +1,155 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sym.h"
+#include "arena.h"
+
+#define SYM_SLOTS_MIN 1024
+#define SYM_CHUNK_MIN 1024
+#define SYM_CHUNKS 22
+
+typedef struct {
+    const char *str;
+    uint32_t len;
+    uint32_t hash;
+} sym_entry_t;
+
+// Entries live in chunks of doubling size that never move, so sym_name
+// can read them without taking the lock that guards interning
+static struct {
+    pthread_mutex_t lock;
+    arena_t arena;
+    sym_entry_t *chunks[SYM_CHUNKS];
+    size_t n_entries;
+    sym_t *slots;
+    size_t n_slots;
+} table = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static const char *builtins[SYM_BUILTIN] = {
+    [SYM_NONE] = "",
+    [SYM_FFI_EXTERN] = "ffi_extern",
+    [SYM_FFI_CALL] = "ffi_call",
+    [SYM_MAIN] = "main",
+    [SYM_ARROW] = "->",
+    [SYM_UNIT] = "()",
+    [SYM_INT] = "Int",
+    [SYM_STR] = "Str",
+    [SYM_FFI] = "Ffi",
+};
+
+static uint32_t sym_hash(const char *str, size_t len)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static sym_entry_t *sym_entry(sym_t sym)
+{
+    // Chunk k holds SYM_CHUNK_MIN << k entries
+    size_t n = sym / SYM_CHUNK_MIN + 1;
+    size_t k = 63 - __builtin_clzll(n);
+    return &table.chunks[k][sym - SYM_CHUNK_MIN * ((1ul << k) - 1)];
+}
+
+static void sym_rehash(size_t n_slots)
+{
+    free(table.slots);
+    table.slots = calloc(n_slots, sizeof(sym_t));
+    table.n_slots = n_slots;
+
+    // Slot value 0 (SYM_NONE) marks an empty slot
+    for (sym_t sym = 1; sym < table.n_entries; sym++) {
+        size_t i = sym_entry(sym)->hash & (n_slots - 1);
+        while (table.slots[i] != SYM_NONE)
+            i = (i + 1) & (n_slots - 1);
+        table.slots[i] = sym;
+    }
+}
+
+void sym_init(void)
+{
+    arena_init(&table.arena);
+    memset(table.chunks, 0, sizeof(table.chunks));
+    table.n_entries = 0;
+    table.slots = NULL;
+    sym_rehash(SYM_SLOTS_MIN);
+
+    for (size_t i = 0; i < SYM_BUILTIN; i++)
+        sym_intern(builtins[i], strlen(builtins[i]));
+}
+
+static sym_t sym_insert(const char *str, size_t len, uint32_t hash)
+{
+    sym_t sym = table.n_entries++;
+    size_t k = 63 - __builtin_clzll(sym / SYM_CHUNK_MIN + 1);
+    if (table.chunks[k] == NULL)
+        table.chunks[k] = malloc((SYM_CHUNK_MIN << k) * sizeof(sym_entry_t));
+
+    sym_entry_t *entry = sym_entry(sym);
+    entry->str = arena_strndup(&table.arena, str, len);
+    entry->len = len;
+    entry->hash = hash;
+    return sym;
+}
+
+static sym_t sym_lookup(const char *str, size_t len, uint32_t hash)
+{
+    // SYM_NONE is the empty string, never stored in the slots
+    if (table.n_entries == 0)
+        return sym_insert(str, len, hash);
+
+    size_t i = hash & (table.n_slots - 1);
+    for ( ; table.slots[i] != SYM_NONE; i = (i + 1) & (table.n_slots - 1)) {
+        sym_entry_t *entry = sym_entry(table.slots[i]);
+        if (entry->hash == hash && entry->len == len && !memcmp(entry->str, str, len))
+            return table.slots[i];
+    }
+
+    sym_t sym = sym_insert(str, len, hash);
+    table.slots[i] = sym;
+
+    // Keep the load factor under 1/2
+    if (table.n_entries * 2 > table.n_slots)
+        sym_rehash(table.n_slots * 2);
+
+    return sym;
+}
+
+sym_t sym_intern(const char *str, size_t len)
+{
+    uint32_t hash = sym_hash(str, len);
+
+    pthread_mutex_lock(&table.lock);
+    sym_t sym = sym_lookup(str, len, hash);
+    pthread_mutex_unlock(&table.lock);
+    return sym;
+}
+
+const char *sym_name(sym_t sym)
+{
+    return sym_entry(sym)->str;
+}
+
+size_t sym_count(void)
+{
+    pthread_mutex_lock(&table.lock);
+    size_t n_entries = table.n_entries;
+    pthread_mutex_unlock(&table.lock);
+    return n_entries;
+}
+
+void sym_free(void)
+{
+    for (size_t k = 0; k < SYM_CHUNKS; k++)
+        free(table.chunks[k]);
+    free(table.slots);
+    arena_free(&table.arena);
+}
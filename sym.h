@@ -0,0 +1,33 @@
+#ifndef SYM_H
+#define SYM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t sym_t;
+
+// Symbols interned by sym_init, in this order
+typedef enum {
+    SYM_NONE,
+    SYM_FFI_EXTERN,
+    SYM_FFI_CALL,
+    SYM_MAIN,
+    SYM_ARROW,
+    SYM_UNIT,
+    SYM_INT,
+    SYM_STR,
+    SYM_FFI,
+    SYM_BUILTIN,
+} sym_builtin_t;
+
+void sym_init(void);
+
+sym_t sym_intern(const char *str, size_t len);
+
+const char *sym_name(sym_t sym);
+
+size_t sym_count(void);
+
+void sym_free(void);
+
+#endif
@@ -1,23 +1,118 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdarg.h>
+#include <sys/types.h>
 
 #include "type.h"
 
-type_t *type_var_new(char *name, type_id_t id)
+type_t *type_var_new(arena_t *arena, sym_t name, type_id_t id)
 {
-    type_var_t *type = calloc(1, sizeof(type_var_t));
+    type_var_t *type = arena_calloc(arena, 1, sizeof(type_var_t));
     type->base.tag = TYPE_VAR;
     type->name = name;
     type->id = id;
     return (type_t *)type;
 }
 
-type_t *type_con_new(char *name, size_t n_args, type_t **args)
+#define TYPE_SLOTS_MIN 256
+
+// Hash-consed ground types, shared by every unit. Interned nodes are
+// never written again, so only interning takes the lock.
+static struct {
+    pthread_mutex_t lock;
+    arena_t arena;
+    type_con_t **slots;
+    size_t n_slots;
+    size_t n_types;
+} table = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+void type_table_init(void)
+{
+    arena_init(&table.arena);
+    table.slots = calloc(TYPE_SLOTS_MIN, sizeof(type_con_t *));
+    table.n_slots = TYPE_SLOTS_MIN;
+    table.n_types = 0;
+}
+
+static uint32_t type_hash(sym_t name, size_t n_args, type_t **args)
+{
+    uint64_t hash = name * 0x9e3779b97f4a7c15u;
+    for (size_t i = 0; i < n_args; i++) {
+        hash ^= (uintptr_t)args[i] >> 4;
+        hash *= 0x9e3779b97f4a7c15u;
+    }
+    return hash >> 32;
+}
+
+static size_t type_table_find(sym_t name, size_t n_args, type_t **args)
+{
+    size_t i = type_hash(name, n_args, args) & (table.n_slots - 1);
+    for ( ; table.slots[i]; i = (i + 1) & (table.n_slots - 1)) {
+        type_con_t *con = table.slots[i];
+        if (con->name == name && con->n_args == n_args
+            && !memcmp(con->args, args, n_args * sizeof(type_t *)))
+            break;
+    }
+    return i;
+}
+
+static void type_table_grow(void)
+{
+    type_con_t **slots = table.slots;
+    size_t n_slots = table.n_slots;
+
+    table.n_slots *= 2;
+    table.slots = calloc(table.n_slots, sizeof(type_con_t *));
+
+    for (size_t i = 0; i < n_slots; i++) {
+        type_con_t *con = slots[i];
+        if (con != NULL)
+            table.slots[type_table_find(con->name, con->n_args, con->args)] = con;
+    }
+    free(slots);
+}
+
+static type_t *type_intern(sym_t name, size_t n_args, type_t **args)
 {
-    type_con_t *type = calloc(1, sizeof(type_con_t));
+    pthread_mutex_lock(&table.lock);
+
+    size_t i = type_table_find(name, n_args, args);
+    type_con_t *found = table.slots[i];
+    if (found != NULL) {
+        pthread_mutex_unlock(&table.lock);
+        return (type_t *)found;
+    }
+
+    type_con_t *type = arena_calloc(&table.arena, 1, sizeof(type_con_t));
+    type->base.tag = TYPE_CON;
+    type->base.ground = true;
+    type->name = name;
+    type->n_args = n_args;
+    type->args = arena_alloc(&table.arena, n_args * sizeof(type_t *));
+    memcpy(type->args, args, n_args * sizeof(type_t *));
+
+    table.slots[i] = type;
+    if (++table.n_types * 2 > table.n_slots)
+        type_table_grow();
+
+    pthread_mutex_unlock(&table.lock);
+    return (type_t *)type;
+}
+
+type_t *type_con_new(arena_t *arena, sym_t name, size_t n_args, type_t **args)
+{
+    bool ground = true;
+    for (size_t i = 0; i < n_args && ground; i++)
+        ground = args[i]->ground;
+
+    // Structurally equal ground types are the same node
+    if (ground)
+        return type_intern(name, n_args, args);
+
+    type_con_t *type = arena_calloc(arena, 1, sizeof(type_con_t));
     type->base.tag = TYPE_CON;
     type->name = name;
     type->n_args = n_args;
@@ -25,17 +120,17 @@ type_t *type_con_new(char *name, size_t n_args, type_t **args)
     return (type_t *)type;
 }
 
-type_t *type_con_new_v(char *name, size_t n_args, ...)
+type_t *type_con_new_v(arena_t *arena, sym_t name, size_t n_args, ...)
 {
     va_list vargs;
     va_start(vargs, n_args);
 
-    type_t **args = calloc(n_args, sizeof(type_t *));
+    type_t **args = arena_calloc(arena, n_args, sizeof(type_t *));
     for (size_t i = 0; i < n_args; i++)
         args[i] = va_arg(vargs, type_t *);
 
     va_end(vargs);
-    return type_con_new(name, n_args, args);
+    return type_con_new(arena, name, n_args, args);
 }
 
 void type_print(type_t *type)
@@ -44,7 +139,7 @@ void type_print(type_t *type)
         case TYPE_VAR: {
             type_var_t *var = (type_var_t *)type;
             if (var->name && !var->id)
-                printf("%s", var->name);
+                fputs(sym_name(var->name), stdout);
             else
                 printf("t%u", var->id);
             break;
@@ -52,9 +147,9 @@ void type_print(type_t *type)
 
         case TYPE_CON: {
             type_con_t *con = (type_con_t *)type;
-            bool infix = !strcmp(con->name, "->");
+            bool infix = con->name == SYM_ARROW;
 
-            if (!infix) fputs(con->name, stdout);
+            if (!infix) fputs(sym_name(con->name), stdout);
 
             if (con->n_args > 0) {
                 if (!infix) putc(' ', stdout);
@@ -63,7 +158,7 @@ void type_print(type_t *type)
                     bool paren = con->args[i]->tag != TYPE_VAR &&
                         !(con->args[i]->tag == TYPE_CON &&
                         (((type_con_t *)con->args[i])->n_args == 0
-                        || !strcmp(((type_con_t *)con->args[i])->name, "->")) && infix);
+                        || ((type_con_t *)con->args[i])->name == SYM_ARROW) && infix);
 
                     if (paren) putc('(', stdout);
                     type_print(con->args[i]);
@@ -71,7 +166,7 @@ void type_print(type_t *type)
 
 
                     if (i != con->n_args - 1) {
-                        if (infix) fprintf(stdout, " %s ", con->name);
+                        if (infix) fputs(" -> ", stdout);
                         else putc(' ', stdout);
                     }
                 }
@@ -87,64 +182,180 @@ void type_println(type_t *type)
     puts("");
 }
 
-void type_free(type_t *type)
+static ssize_t type_scheme_index(type_scheme_t *scheme, type_t *type)
+{
+    if (type->tag != TYPE_VAR)
+        return -1;
+
+    type_var_t *var = (type_var_t *)type;
+    for (size_t i = 0; i < scheme->n_vars; i++) {
+        if (scheme->vars[i] == var->id)
+            return i;
+    }
+    return -1;
+}
+
+static bool type_scheme_mark(type_scheme_t *scheme, type_t *type, bool *quant, size_t *n_quant)
 {
-    if (type->tag == TYPE_CON) {
+    size_t index = (*n_quant)++;
+    bool held = type_scheme_index(scheme, type) >= 0;
+
+    if (type->tag == TYPE_CON && !type->ground) {
         type_con_t *con = (type_con_t *)type;
         for (size_t i = 0; i < con->n_args; i++)
-            type_free(con->args[i]);
-        free(con->name);
-        free(con->args);
-    } else if (type->tag == TYPE_VAR) {
-        type_var_t *var = (type_var_t *)type;
-        free(var->name);
+            held |= type_scheme_mark(scheme, con->args[i], quant, n_quant);
     }
 
-    free(type);
+    // Instantiation does not look inside the nodes without any
+    if (!held)
+        *n_quant = index + 1;
+    if (quant)
+        quant[index] = held;
+    return held;
 }
 
-void type_scheme_init(type_scheme_t *scheme, type_t *type, size_t n_vars, type_id_t *vars)
+void type_scheme_init(arena_t *arena, type_scheme_t *scheme, type_t *type, size_t n_vars, type_id_t *vars)
 {
     scheme->type = type;
     scheme->n_vars = n_vars;
     scheme->vars = vars;
+    scheme->quant = NULL;
+    if (type == NULL || n_vars == 0)
+        return;
+
+    // Counted first, then filled in
+    size_t n_quant = 0;
+    type_scheme_mark(scheme, type, NULL, &n_quant);
+    scheme->quant = arena_alloc(arena, n_quant * sizeof(bool));
+    n_quant = 0;
+    type_scheme_mark(scheme, type, scheme->quant, &n_quant);
 }
 
-bool type_scheme_instantiate(type_scheme_t *scheme, type_var_t **new, type_t **out)
+static type_t *type_scheme_subst(arena_t *arena, type_scheme_t *scheme, type_t **types, type_t *type,
+                                 size_t *n_quant)
 {
-    if (scheme->type->tag == TYPE_VAR) {
-        type_var_t *var = (type_var_t *)scheme->type;
-        type_t *res = scheme->type;
+    if (!scheme->quant[(*n_quant)++])
+        return type;
 
-        for (size_t i = 0; i < scheme->n_vars; i++) {
-            if (scheme->vars[i] == var->id) {
-                res = (type_t *)new[i];
-                break;
-            }
-        }
+    ssize_t index = type_scheme_index(scheme, type);
+    if (index >= 0)
+        return types[index];
+
+    type_con_t *con = (type_con_t *)type;
+    type_t **args = arena_alloc(arena, con->n_args * sizeof(type_t *));
+    for (size_t i = 0; i < con->n_args; i++)
+        args[i] = type_scheme_subst(arena, scheme, types, con->args[i], n_quant);
+
+    return type_con_new(arena, con->name, con->n_args, args);
+}
+
+bool type_scheme_instantiate(arena_t *arena, type_scheme_t *scheme, type_var_t **new, type_t **out)
+{
+    if (scheme->type == NULL)
+        return false;
 
-        *out = res;
+    // Subtrees without quantified vars are shared with the scheme. Which
+    // they are is kept on the scheme rather than on the nodes, since a
+    // node may be shared by schemes quantifying different vars.
+    if (scheme->quant == NULL) {
+        *out = scheme->type;
         return true;
     }
 
-    if (scheme->type->tag == TYPE_CON) {
-        type_con_t *con = (type_con_t *)scheme->type;
-        type_t **args = calloc(con->n_args, sizeof(type_t *));
+    size_t n_quant = 0;
+    *out = type_scheme_subst(arena, scheme, (type_t **)new, scheme->type, &n_quant);
+    return true;
+}
 
-        type_scheme_t copy;
-        memcpy(&copy, scheme, sizeof(type_scheme_t));
+static bool type_equal(type_t *a, type_t *b)
+{
+    if (a == b)
+        return true;
+    if (a->tag != b->tag || a->ground || b->ground)
+        return false;
 
-        for (size_t i = 0; i < con->n_args; i++) {
-            copy.type = con->args[i];
-            if (!type_scheme_instantiate(&copy, new, &args[i]))
-                return false;
-        }
+    if (a->tag == TYPE_VAR)
+        return ((type_var_t *)a)->id == ((type_var_t *)b)->id;
+
+    type_con_t *ca = (type_con_t *)a, *cb = (type_con_t *)b;
+    if (ca->name != cb->name || ca->n_args != cb->n_args)
+        return false;
+
+    for (size_t i = 0; i < ca->n_args; i++) {
+        if (!type_equal(ca->args[i], cb->args[i]))
+            return false;
+    }
+    return true;
+}
+
+static bool type_match(type_scheme_t *scheme, type_t *pattern, type_t *inst, type_t **types)
+{
+    ssize_t index = type_scheme_index(scheme, pattern);
+    if (index >= 0) {
+        if (types[index] == NULL)
+            types[index] = inst;
+        return type_equal(types[index], inst);
+    }
 
-        *out = type_con_new(con->name, con->n_args, args);
+    // Other vars were fixed by inference after the scheme was made, inst
+    // has them resolved
+    if (pattern->tag == TYPE_VAR)
         return true;
+
+    if (inst->tag != TYPE_CON)
+        return false;
+
+    type_con_t *cp = (type_con_t *)pattern, *ci = (type_con_t *)inst;
+    if (cp->name != ci->name || cp->n_args != ci->n_args)
+        return false;
+
+    for (size_t i = 0; i < cp->n_args; i++) {
+        if (!type_match(scheme, cp->args[i], ci->args[i], types))
+            return false;
     }
+    return true;
+}
+
+bool type_scheme_match(type_scheme_t *scheme, type_t *inst, type_t **types)
+{
+    if (scheme->type == NULL)
+        return false;
+
+    memset(types, 0, scheme->n_vars * sizeof(type_t *));
+    return type_match(scheme, scheme->type, inst, types);
+}
 
-    return false;
+type_t *type_scheme_apply(arena_t *arena, type_scheme_t *scheme, type_t **types, type_t *type)
+{
+    if (type->ground || scheme->n_vars == 0)
+        return type;
+
+    ssize_t index = type_scheme_index(scheme, type);
+    if (index >= 0)
+        return types[index];
+    if (type->tag == TYPE_VAR)
+        return type;
+
+    // The args are only copied once one of them changes
+    type_con_t *con = (type_con_t *)type;
+    type_t **args = NULL;
+    for (size_t i = 0; i < con->n_args; i++) {
+        type_t *arg = type_scheme_apply(arena, scheme, types, con->args[i]);
+        if (args == NULL && arg != con->args[i]) {
+            args = arena_alloc(arena, con->n_args * sizeof(type_t *));
+            memcpy(args, con->args, i * sizeof(type_t *));
+        }
+        if (args)
+            args[i] = arg;
+    }
+
+    return args ? type_con_new(arena, con->name, con->n_args, args) : type;
+}
+
+void type_table_free(void)
+{
+    free(table.slots);
+    arena_free(&table.arena);
 }
 
 void type_scheme_print(type_scheme_t *scheme)
@@ -5,6 +5,9 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+#include "arena.h"
+#include "sym.h"
+
 typedef enum {
     TYPE_VAR,
     TYPE_CON,
@@ -14,18 +17,18 @@ typedef uint32_t type_id_t;
 
 typedef struct {
     type_tag_t tag;
+    bool ground;
 } type_t;
 
 typedef struct {
     type_t base;
-    char *name;
+    sym_t name;
     type_id_t id;
-    type_t *forward;
 } type_var_t;
 
 typedef struct {
     type_t base;
-    char *name;
+    sym_t name;
     size_t n_args;
     type_t **args;
 } type_con_t;
@@ -34,24 +37,37 @@ typedef struct {
     size_t n_vars;
     type_id_t *vars;
     type_t *type;
+    // Whether each node of type holds a quantified var, in preorder and
+    // leaving out the subtrees of the nodes that hold none
+    bool *quant;
 } type_scheme_t;
 
+void type_table_init(void);
 
-type_t *type_var_new(char *name, type_id_t id);
+type_t *type_var_new(arena_t *arena, sym_t name, type_id_t id);
 
-type_t *type_con_new(char *name, size_t n_args, type_t **args);
+type_t *type_con_new(arena_t *arena, sym_t name, size_t n_args, type_t **args);
 
-type_t *type_con_new_v(char *name, size_t n_args, ...);
+type_t *type_con_new_v(arena_t *arena, sym_t name, size_t n_args, ...);
 
 void type_print(type_t *type);
 
 void type_println(type_t *type);
 
-void type_free(type_t *type);
+void type_table_free(void);
+
+void type_scheme_init(arena_t *arena, type_scheme_t *scheme, type_t *type, size_t n_vars, type_id_t *vars);
+
+// The type of scheme with its quantified vars replaced by the ones in new,
+// sharing the nodes that hold none of them
+bool type_scheme_instantiate(arena_t *arena, type_scheme_t *scheme, type_var_t **new, type_t **out);
 
-void type_scheme_init(type_scheme_t *scheme, type_t *type, size_t n_vars, type_id_t *vars);
+// Finds the types the quantified vars of scheme take in inst, an instance
+// of it, filling in types in the order of scheme->vars
+bool type_scheme_match(type_scheme_t *scheme, type_t *inst, type_t **types);
 
-bool type_scheme_instantiate(type_scheme_t *scheme, type_var_t **new, type_t **out);
+// type with the quantified vars of scheme replaced by types
+type_t *type_scheme_apply(arena_t *arena, type_scheme_t *scheme, type_t **types, type_t *type);
 
 void type_scheme_print(type_scheme_t *scheme);
 